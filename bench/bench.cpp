@@ -0,0 +1,411 @@
+// Microbenchmarks of the ingest, scan and serialization paths. Inputs are
+// generated from a fixed seed, so numbers from two builds are comparable.
+//
+//   logan_bench [--records=N] [--runs=N] [--filter=TEXT] [--dir=PATH]
+//
+// Each benchmark runs `runs` times after one warm-up run; the median and the
+// fastest run are reported.
+
+#include "../src/logging/log_level.h"
+#include "../src/logging/log_record.h"
+#include "../src/querying/query_params.h"
+#include "../src/querying/text_match.h"
+#include "../src/serialization/json_writer.h"
+#include "../src/sink/file_sink.h"
+#include "../src/sink/sharded_sink.h"
+#include "../src/source/file_source.h"
+#include "../src/storage/record_format.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+struct BenchOptions {
+  size_t records = 500000;
+  int runs = 5;
+  std::string filter;                                       // Only run benchmarks whose name contains this
+  std::string directory;
+};
+
+using Clock = std::chrono::steady_clock;
+
+// One timed run: the work processed and the time it took
+struct Sample {
+  double seconds = 0;
+  uint64_t items = 0;
+  uint64_t bytes = 0;
+};
+
+double since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::vector<LogRecord> generateRecords(size_t count) {
+  static const char* kWords[] = {
+    "request", "handled", "user", "session", "timeout", "retry", "cache", "miss", "upstream", "connection",
+    "closed", "token", "expired", "payment", "declined", "queue", "latency", "slow", "query", "shard"
+  };
+  static const LogLevel kLevels[] = {
+    LogLevel::Info, LogLevel::Info, LogLevel::Info, LogLevel::Info, LogLevel::Info, LogLevel::Info,
+    LogLevel::Debug, LogLevel::Debug, LogLevel::Warn, LogLevel::Error
+  };
+
+  std::mt19937_64 random(42);
+  std::vector<LogRecord> records;
+  records.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    LogRecord record;
+    record.timestamp = 1700000000 + static_cast<int64_t>(i / 100);
+    record.service = "service-" + std::to_string(random() % 16);
+    record.level = kLevels[random() % std::size(kLevels)];
+    size_t words = 4 + random() % 9;
+    for (size_t w = 0; w < words; ++w) {
+      record.message += kWords[random() % std::size(kWords)];
+      record.message += ' ';
+    }
+    record.message += "id=" + std::to_string(random() % 1000000);
+    records.push_back(std::move(record));
+  }
+  return records;
+}
+
+uint64_t recordBytes(const std::vector<LogRecord>& records) {
+  uint64_t bytes = 0;
+  for (const auto& record : records) {
+    bytes += record.service.size() + record.message.size() + 16;
+  }
+  return bytes;
+}
+
+void removeDirectory(const std::string& directory) {
+  std::error_code ec;
+  std::filesystem::remove_all(directory, ec);
+}
+
+class Bench {
+public:
+  explicit Bench(BenchOptions options) : options_(std::move(options)) {
+    std::printf("%-36s %10s %10s %14s %10s\n", "benchmark", "median ms", "min ms", "items/s", "MB/s");
+  }
+
+  void run(const std::string& name, const std::function<Sample()>& body) {
+    if (name.find(options_.filter) == std::string::npos) {
+      return;
+    }
+
+    body();                                                 // Warm-up: page cache, allocator, lazy init
+    std::vector<Sample> samples;
+    for (int i = 0; i < std::max(options_.runs, 1); ++i) {
+      samples.push_back(body());
+    }
+    std::sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) {
+      return a.seconds < b.seconds;
+    });
+
+    const Sample& median = samples[samples.size() / 2];
+    double seconds = std::max(median.seconds, 1e-9);
+    std::printf("%-36s %10.2f %10.2f %14.0f %10.1f\n",
+      name.c_str(),
+      median.seconds * 1e3,
+      samples.front().seconds * 1e3,
+      median.items / seconds,
+      median.bytes / seconds / (1024 * 1024));
+    std::fflush(stdout);
+  }
+
+private:
+  BenchOptions options_;
+};
+
+std::string formatName(StorageFormat format) {
+  return format == StorageFormat::Block ? "block" : "text";
+}
+
+// Producer-side cost of handing batches to the sink, and the time the writer
+// then needs to get everything into segment files
+void benchSink(Bench& bench, const BenchOptions& options, const std::vector<LogRecord>& records, StorageFormat format) {
+  uint64_t bytes = recordBytes(records);
+  constexpr size_t kBatch = 1000;
+
+  auto ingest = [&](Durability durability, size_t count, Sample& enqueue, Sample& flush) {
+    std::string directory = options.directory + "/sink";
+    removeDirectory(directory);
+
+    FileSinkOptions sinkOptions;
+    sinkOptions.format = format;
+    sinkOptions.durability = durability;
+    auto sink = std::make_unique<FileSink>(directory, sinkOptions);
+
+    auto start = Clock::now();
+    std::vector<LogRecord> batch;
+    for (size_t i = 0; i < count; i += kBatch) {
+      batch.assign(records.begin() + i, records.begin() + std::min(count, i + kBatch));
+      sink->writeBatch(batch);
+    }
+    enqueue = Sample{since(start), count, bytes * count / records.size()};
+
+    auto drained = Clock::now();
+    sink.reset();                                           // Drains the queue and closes the segment
+    flush = Sample{since(drained), count, bytes * count / records.size()};
+    removeDirectory(directory);
+  };
+
+  std::string prefix = "filesink/" + formatName(format);
+  Sample enqueue;
+  Sample flush;
+  bench.run(prefix + "/enqueue", [&] {
+    ingest(Durability::None, records.size(), enqueue, flush);
+    return enqueue;
+  });
+  bench.run(prefix + "/flush", [&] {
+    ingest(Durability::None, records.size(), enqueue, flush);
+    return flush;
+  });
+
+  // Every batch waits for its fdatasync, so this mostly measures the disk
+  bench.run(prefix + "/group-commit", [&] {
+    size_t count = std::min<size_t>(records.size(), 50 * kBatch);
+    ingest(Durability::GroupCommit, count, enqueue, flush);
+    return Sample{enqueue.seconds + flush.seconds, enqueue.items, enqueue.bytes};
+  });
+}
+
+// Several producers ingesting at once through 1, 2 and 4 shards, timed until
+// every record is in a segment file
+void benchShards(Bench& bench, const BenchOptions& options, const std::vector<LogRecord>& records, StorageFormat format) {
+  uint64_t bytes = recordBytes(records);
+  constexpr size_t kBatch = 1000;
+  constexpr size_t kProducers = 4;
+
+  for (size_t shards : {1, 2, 4}) {
+    bench.run("shardedsink/" + formatName(format) + "/" + std::to_string(shards) + "-shards", [&] {
+      std::string root = options.directory + "/sharded";
+      removeDirectory(root);
+
+      FileSinkOptions sinkOptions;
+      sinkOptions.format = format;
+      sinkOptions.durability = Durability::None;
+      auto sink = std::make_unique<ShardedSink>(shardDirectories(root, shards), sinkOptions);
+
+      auto start = Clock::now();
+      std::vector<std::thread> producers;
+      for (size_t p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&, p] {
+          std::vector<LogRecord> batch;
+          for (size_t i = p * kBatch; i < records.size(); i += kProducers * kBatch) {
+            batch.assign(records.begin() + i, records.begin() + std::min(records.size(), i + kBatch));
+            sink->writeBatch(batch);
+          }
+        });
+      }
+      for (auto& producer : producers) {
+        producer.join();
+      }
+      sink.reset();                                         // Drains every shard's queue
+      Sample sample{since(start), records.size(), bytes};
+
+      removeDirectory(root);
+      return sample;
+    });
+  }
+}
+
+void benchSource(Bench& bench, const BenchOptions& options, const std::vector<LogRecord>& records, StorageFormat format) {
+  std::string directory = options.directory + "/source-" + formatName(format);
+  removeDirectory(directory);
+  {
+    FileSinkOptions sinkOptions;
+    sinkOptions.format = format;
+    sinkOptions.durability = Durability::None;
+    FileSink sink(directory, sinkOptions);
+    std::vector<LogRecord> batch;
+    for (size_t i = 0; i < records.size(); i += sink.queueCapacity()) {
+      batch.assign(records.begin() + i, records.begin() + std::min(records.size(), i + sink.queueCapacity()));
+      sink.writeBatch(batch);                                 // A batch larger than the queue is refused
+    }
+  }
+  uint64_t bytes = 0;
+  for (const auto& segment : listSegments(directory)) {
+    std::error_code ec;
+    bytes += std::filesystem::file_size(segment.dataPath, ec);
+  }
+
+  // Cached results would turn every run after the first into a replay
+  FileSourceOptions sourceOptions;
+  sourceOptions.resultCacheBytes = 0;
+  FileSource source(directory, sourceOptions);
+
+  int64_t first = records.front().timestamp;
+  int64_t last = records.back().timestamp;
+
+  struct Query {
+    const char* name;
+    QueryParams params;
+  };
+  std::vector<Query> queries(6);
+  queries[0].name = "all";
+  queries[1].name = "service";
+  queries[1].params.service = "service-3";
+  queries[2].name = "level";
+  queries[2].params.level = LogLevel::Error;
+  queries[3].name = "substring";
+  queries[3].params.contains = "payment declined";
+  queries[4].name = "regex";
+  queries[4].params.regex = "token (expired|timeout)";
+  queries[5].name = "range-10pct";
+  queries[5].params.from = first + (last - first) / 2;
+  queries[5].params.to = first + (last - first) / 2 + (last - first) / 10;
+
+  for (const auto& query : queries) {
+    if (query.params.regex && regexError(query.params.regex.value())) {
+      continue;                                             // Built without RE2
+    }
+    bench.run("filesource/" + formatName(format) + "/" + query.name, [&] {
+      uint64_t matches = 0;
+      auto start = Clock::now();
+      source.scan(query.params, [&](const LogRecordView&) {
+        ++matches;
+        return true;
+      });
+      return Sample{since(start), records.size(), bytes};
+    });
+  }
+
+  removeDirectory(directory);
+}
+
+// Patterns that make a backtracking engine recurse once per character of a
+// 64 KiB message, the longest a line can be over the raw listener
+void benchRegex(Bench& bench) {
+  if (regexError("x")) {
+    return;
+  }
+  std::string message(64 * 1024, 'a');
+  for (auto [name, pattern] : {std::pair{"alternation", "(.|x)*y"}, std::pair{"nested", "((a|b)*)*y"}}) {
+    QueryParams params;
+    params.regex = pattern;
+    TextMatcher matcher(params);
+    bench.run(std::string("regex/long-message/") + name, [&] {
+      auto start = Clock::now();
+      matcher.matches(message);
+      return Sample{since(start), 1, message.size()};
+    });
+  }
+}
+
+void benchRecords(Bench& bench, const std::vector<LogRecord>& records) {
+  std::string text;
+  bench.run("record/format", [&] {
+    text.clear();
+    auto start = Clock::now();
+    for (const auto& record : records) {
+      formatRecord(text, record);
+    }
+    return Sample{since(start), records.size(), text.size()};
+  });
+
+  bench.run("record/parse", [&] {
+    uint64_t parsed = 0;
+    auto start = Clock::now();
+    std::string_view rest = text;
+    while (!rest.empty()) {
+      size_t newline = rest.find('\n');
+      RecordFields fields;
+      parsed += parseRecord(rest.substr(0, newline), fields);
+      rest.remove_prefix(newline == std::string_view::npos ? rest.size() : newline + 1);
+    }
+    return Sample{since(start), parsed, text.size()};
+  });
+
+  // Most lines fail the predicate after the timestamp or service and are
+  // never parsed further
+  RecordPredicate predicate;
+  predicate.service = records.front().service;
+  predicate.level = LogLevel::Error;
+  bench.run("record/parse-filtered", [&] {
+    uint64_t lines = 0;
+    auto start = Clock::now();
+    std::string_view rest = text;
+    while (!rest.empty()) {
+      size_t newline = rest.find('\n');
+      RecordFields fields;
+      parseRecord(rest.substr(0, newline), predicate, fields);
+      ++lines;
+      rest.remove_prefix(newline == std::string_view::npos ? rest.size() : newline + 1);
+    }
+    return Sample{since(start), lines, text.size()};
+  });
+
+  std::string json;
+  bench.run("json/records", [&] {
+    json.clear();
+    auto start = Clock::now();
+    for (const auto& record : records) {
+      appendJsonRecord(json, LogRecordView{record.timestamp, record.service, record.level, record.message});
+      json += ',';
+    }
+    return Sample{since(start), records.size(), json.size()};
+  });
+}
+
+bool parseOption(const std::string& arg, const char* name, std::string& value) {
+  std::string prefix = std::string("--") + name + "=";
+  if (arg.rfind(prefix, 0) != 0) {
+    return false;
+  }
+  value = arg.substr(prefix.size());
+  return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  options.directory = (std::filesystem::temp_directory_path() / ("logan-bench-" + std::to_string(::getpid()))).string();
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (parseOption(arg, "records", value)) {
+      options.records = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (parseOption(arg, "runs", value)) {
+      options.runs = std::atoi(value.c_str());
+    } else if (parseOption(arg, "filter", value)) {
+      options.filter = value;
+    } else if (parseOption(arg, "dir", value)) {
+      options.directory = value;
+    } else {
+      std::fprintf(stderr, "usage: %s [--records=N] [--runs=N] [--filter=TEXT] [--dir=PATH]\n", argv[0]);
+      return 2;
+    }
+  }
+  options.records = std::max<size_t>(options.records, 1);
+
+  auto records = generateRecords(options.records);
+  std::printf("%zu records, %.1f MB of fields, %d runs\n\n", records.size(), recordBytes(records) / (1024.0 * 1024), options.runs);
+
+  Bench bench(options);
+  benchRecords(bench, records);
+  benchRegex(bench);
+  for (auto format : {StorageFormat::Text, StorageFormat::Block}) {
+    benchSink(bench, options, records, format);
+    benchShards(bench, options, records, format);
+    benchSource(bench, options, records, format);
+  }
+
+  removeDirectory(options.directory);
+  return 0;
+}
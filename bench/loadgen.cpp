@@ -0,0 +1,315 @@
+// Drives a running service with concurrent ingest and query traffic and
+// reports throughput and latency percentiles per kind of request.
+//
+//   logan_loadgen [--host=localhost] [--port=8080] [--duration=10]
+//                 [--ingest-threads=2] [--batch=100] [--ingest-rate=0]
+//                 [--query-threads=2] [--query-rate=0] [--queries=PATH,...]
+//                 [--raw-port=0]
+//
+// Rates are requests per second per thread; 0 sends the next request as soon
+// as the previous one returns. With a rate, latency is measured from when a
+// request was due rather than when it was sent, so a stalled server shows up
+// in the percentiles instead of just slowing the load down.
+//
+// With --raw-port, ingest threads stream batches to the raw TCP listener
+// instead of POSTing them. There is no response, so ingest latency is only
+// the time to hand a batch to the socket, which includes waiting out the
+// server's backpressure.
+
+#include "../third_party/httplib.h"
+#include "../src/serialization/json_writer.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <netdb.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadOptions {
+  std::string host = "localhost";
+  int port = 8080;
+  double duration = 10;                                     // Seconds
+  int ingestThreads = 2;
+  size_t batch = 100;                                       // Records per POST /log/batch
+  double ingestRate = 0;
+  int queryThreads = 2;
+  double queryRate = 0;
+  int rawPort = 0;                                          // Ingest over the raw TCP listener when set
+  std::vector<std::string> queries = {                      // Picked uniformly; repeat a path to weight it
+    "/log?limit=100",
+    "/log?service=service-3&limit=100",
+    "/log?level=ERROR&limit=100",
+    "/log?q=timeout&limit=100",
+    "/log/stats?group_by=service,level"
+  };
+};
+
+// What one worker saw; merged once the run is over
+struct Recorder {
+  std::vector<uint32_t> latencies;                          // Microseconds, successful requests only
+  uint64_t errors = 0;
+  uint64_t records = 0;
+};
+
+struct Report {
+  const char* name;
+  Recorder total;
+};
+
+// `count` records as NDJSON for POST /log/batch, or as raw listener lines
+std::string makeBatch(std::mt19937_64& random, size_t count, bool raw) {
+  static const char* kWords[] = {
+    "request", "handled", "user", "session", "timeout", "retry", "cache", "miss", "upstream", "connection",
+    "closed", "token", "expired", "payment", "declined", "queue", "latency", "slow", "query", "shard"
+  };
+  static const char* kLevels[] = {"INFO", "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+
+  int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  std::string body;
+  std::string message;
+  for (size_t i = 0; i < count; ++i) {
+    message.clear();
+    size_t words = 4 + random() % 9;
+    for (size_t w = 0; w < words; ++w) {
+      message += kWords[random() % std::size(kWords)];
+      message += ' ';
+    }
+    message += "id=" + std::to_string(random() % 1000000);
+
+    std::string service = "service-" + std::to_string(random() % 16);
+    const char* level = kLevels[random() % std::size(kLevels)];
+    if (raw) {
+      body += std::to_string(now) + " " + service + " " + level + " " + message + "\n";
+      continue;
+    }
+    body += "{\"service\":\"" + service + "\",\"level\":\"";
+    body += level;
+    body += "\",\"message\":";
+    appendJsonString(body, message);
+    body += ",\"timestamp\":" + std::to_string(now) + "}\n";
+  }
+  return body;
+}
+
+// A blocking TCP connection to the raw listener, or -1
+int connectRaw(const std::string& host, int port) {
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* found = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) {
+    return -1;
+  }
+  int fd = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+  if (fd >= 0 && connect(fd, found->ai_addr, found->ai_addrlen) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(found);
+  return fd;
+}
+
+bool sendAll(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    sent += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// Calls `send` until the deadline, paced at `rate` per second if non-zero
+template <typename Send>
+void drive(Clock::time_point deadline, double rate, Recorder& recorder, Send&& send) {
+  auto interval = rate > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / rate)) : Clock::duration::zero();
+  auto due = Clock::now();
+
+  while (due < deadline && Clock::now() < deadline) {
+    if (rate > 0) {
+      std::this_thread::sleep_until(due);
+    } else {
+      due = Clock::now();
+    }
+    if (send()) {
+      auto latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - due).count();
+      recorder.latencies.push_back(static_cast<uint32_t>(std::min<int64_t>(latency, UINT32_MAX)));
+    } else {
+      ++recorder.errors;
+    }
+    due += interval;
+  }
+}
+
+double percentile(const std::vector<uint32_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+  return sorted[index] / 1e3;
+}
+
+void print(Report& report, double seconds) {
+  auto& latencies = report.total.latencies;
+  std::sort(latencies.begin(), latencies.end());
+  std::printf("%-8s %10zu %8llu %10.0f %12.0f %9.2f %9.2f %9.2f %9.2f\n",
+    report.name,
+    latencies.size(),
+    static_cast<unsigned long long>(report.total.errors),
+    latencies.size() / seconds,
+    report.total.records / seconds,
+    percentile(latencies, 0.50),
+    percentile(latencies, 0.99),
+    percentile(latencies, 0.999),
+    latencies.empty() ? 0.0 : latencies.back() / 1e3);
+}
+
+bool parseOption(const std::string& arg, const char* name, std::string& value) {
+  std::string prefix = std::string("--") + name + "=";
+  if (arg.rfind(prefix, 0) != 0) {
+    return false;
+  }
+  value = arg.substr(prefix.size());
+  return true;
+}
+
+std::vector<std::string> splitList(const std::string& text) {
+  std::vector<std::string> items;
+  size_t start = 0;
+  while (start <= text.size()) {
+    size_t comma = text.find(',', start);
+    if (comma == std::string::npos) {
+      comma = text.size();
+    }
+    if (comma > start) {
+      items.push_back(text.substr(start, comma - start));
+    }
+    start = comma + 1;
+  }
+  return items;
+}
+
+}
+
+int main(int argc, char** argv) {
+  LoadOptions options;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (parseOption(arg, "host", value)) {
+      options.host = value;
+    } else if (parseOption(arg, "port", value)) {
+      options.port = std::atoi(value.c_str());
+    } else if (parseOption(arg, "duration", value)) {
+      options.duration = std::atof(value.c_str());
+    } else if (parseOption(arg, "ingest-threads", value)) {
+      options.ingestThreads = std::atoi(value.c_str());
+    } else if (parseOption(arg, "batch", value)) {
+      options.batch = std::max<size_t>(std::strtoull(value.c_str(), nullptr, 10), 1);
+    } else if (parseOption(arg, "ingest-rate", value)) {
+      options.ingestRate = std::atof(value.c_str());
+    } else if (parseOption(arg, "query-threads", value)) {
+      options.queryThreads = std::atoi(value.c_str());
+    } else if (parseOption(arg, "query-rate", value)) {
+      options.queryRate = std::atof(value.c_str());
+    } else if (parseOption(arg, "queries", value)) {
+      options.queries = splitList(value);
+    } else if (parseOption(arg, "raw-port", value)) {
+      options.rawPort = std::atoi(value.c_str());
+    } else {
+      std::fprintf(stderr,
+        "usage: %s [--host=H] [--port=N] [--duration=S] [--ingest-threads=N] [--batch=N] [--ingest-rate=R]\n"
+        "          [--query-threads=N] [--query-rate=R] [--queries=PATH,...] [--raw-port=N]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (options.queries.empty()) {
+    options.queryThreads = 0;
+  }
+
+  auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration));
+  std::vector<Recorder> ingest(std::max(options.ingestThreads, 0));
+  std::vector<Recorder> query(std::max(options.queryThreads, 0));
+  std::vector<std::thread> workers;
+
+  for (size_t t = 0; t < ingest.size(); ++t) {
+    workers.emplace_back([&, t] {
+      std::mt19937_64 random(1000 + t);
+      if (options.rawPort > 0) {
+        int fd = connectRaw(options.host, options.rawPort);
+        drive(deadline, options.ingestRate, ingest[t], [&] {
+          if (fd < 0 || !sendAll(fd, makeBatch(random, options.batch, true))) {
+            return false;
+          }
+          ingest[t].records += options.batch;
+          return true;
+        });
+        if (fd >= 0) {
+          close(fd);
+        }
+        return;
+      }
+
+      httplib::Client client(options.host, options.port);
+      client.set_keep_alive(true);
+      client.set_tcp_nodelay(true);
+      drive(deadline, options.ingestRate, ingest[t], [&] {
+        std::string body = makeBatch(random, options.batch, false);
+        auto response = client.Post("/log/batch", body, "application/x-ndjson");
+        if (!response || response->status != 201) {
+          return false;
+        }
+        ingest[t].records += options.batch;
+        return true;
+      });
+    });
+  }
+
+  for (size_t t = 0; t < query.size(); ++t) {
+    workers.emplace_back([&, t] {
+      httplib::Client client(options.host, options.port);
+      client.set_keep_alive(true);
+      client.set_tcp_nodelay(true);
+      std::mt19937_64 random(2000 + t);
+      drive(deadline, options.queryRate, query[t], [&] {
+        auto response = client.Get(options.queries[random() % options.queries.size()]);
+        return response && response->status == 200;
+      });
+    });
+  }
+
+  auto start = Clock::now();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::printf("%-8s %10s %8s %10s %12s %9s %9s %9s %9s\n", "", "requests", "errors", "req/s", "records/s", "p50 ms", "p99 ms", "p999 ms", "max ms");
+  for (auto& [name, recorders] : {std::make_pair("ingest", &ingest), std::make_pair("query", &query)}) {
+    if (recorders->empty()) {
+      continue;
+    }
+    Report report{name, {}};
+    for (auto& recorder : *recorders) {
+      report.total.latencies.insert(report.total.latencies.end(), recorder.latencies.begin(), recorder.latencies.end());
+      report.total.errors += recorder.errors;
+      report.total.records += recorder.records;
+    }
+    print(report, seconds);
+  }
+  return 0;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue for many producers and one consumer (Vyukov's
+// sequence-numbered ring). Slots are allocated once up front and values are
+// copied into and swapped out of them, so string buffers get recycled instead
+// of reallocated on every record.
+template <typename T>
+class MpscRing {
+public:
+  explicit MpscRing(size_t capacity)
+    : capacity_(roundUp(capacity)),
+      mask_(capacity_ - 1),
+      slots_(std::make_unique<Slot[]>(capacity_)),
+      head_(0),
+      tail_(0) {
+    for (size_t i = 0; i < capacity_; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  // Approximate while producers are active
+  size_t size() const {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    return head > tail ? static_cast<size_t>(head - tail) : 0;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  // Returns false if the ring is full. On success `claimed` (if given) gets
+  // the value's sequence number; positions are consecutive from 0 in pop order.
+  bool tryPush(const T& value, uint64_t* claimed = nullptr) {
+    uint64_t position = head_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[position & mask_];
+      uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+      int64_t diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          slot.value = value;
+          slot.sequence.store(position + 1, std::memory_order_release);
+          if (claimed) {
+            *claimed = position;
+          }
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        position = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // All or nothing: claims `count` consecutive positions for `values` and
+  // returns true, or returns false with nothing pushed if they don't all fit.
+  // `first` (if given) gets the first value's sequence number.
+  bool tryPushAll(const T* values, size_t count, uint64_t* first = nullptr) {
+    if (count == 0 || count > capacity_) {
+      return count == 0;
+    }
+
+    // The consumer frees slots in order, so if the slot for the last position
+    // is free, so are all the ones before it; acquiring its sequence also
+    // orders the consumer's earlier releases before our writes.
+    uint64_t position = head_.load(std::memory_order_relaxed);
+    while (true) {
+      uint64_t last = position + count - 1;
+      uint64_t sequence = slots_[last & mask_].sequence.load(std::memory_order_acquire);
+      int64_t diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(last);
+
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(position, position + count, std::memory_order_relaxed)) {
+          for (size_t i = 0; i < count; ++i) {
+            Slot& slot = slots_[(position + i) & mask_];
+            slot.value = values[i];
+            slot.sequence.store(position + i + 1, std::memory_order_release);
+          }
+          if (first) {
+            *first = position;
+          }
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        position = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer only. Swaps the oldest value into `out`, handing `out`'s old
+  // buffers back to the slot for reuse.
+  bool tryPop(T& out) {
+    uint64_t position = tail_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[position & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+      return false;
+    }
+
+    using std::swap;
+    swap(out, slot.value);
+    slot.sequence.store(position + capacity_, std::memory_order_release);
+    tail_.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> sequence;
+    T value;
+  };
+
+  static size_t roundUp(size_t capacity) {
+    size_t rounded = 2;
+    while (rounded < capacity) {
+      rounded <<= 1;
+    }
+    return rounded;
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<uint64_t> head_;                  // Next position to claim
+  alignas(64) std::atomic<uint64_t> tail_;                  // Next position to consume
+};
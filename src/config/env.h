@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Deployment settings come from LOGAN_* environment variables; unset or
+// unparsable values fall back to the given default.
+
+inline std::string envString(const char* name, const std::string& fallback) {
+  const char* value = std::getenv(name);
+  return value && *value ? std::string(value) : fallback;
+}
+
+inline int64_t envInt(const char* name, int64_t fallback) {
+  const char* value = std::getenv(name);
+  if (!value || !*value) {
+    return fallback;
+  }
+  char* end = nullptr;
+  long long parsed = std::strtoll(value, &end, 10);
+  return *end == '\0' ? static_cast<int64_t>(parsed) : fallback;
+}
+
+// A count, size or port, which can't be negative. Unlike envInt, a value that
+// doesn't parse or is out of range stops the process with an error, since
+// e.g. -1 cast to a size would silently mean "unlimited".
+inline uint64_t envSize(const char* name, uint64_t fallback, uint64_t max = std::numeric_limits<int64_t>::max()) {
+  const char* value = std::getenv(name);
+  if (!value || !*value) {
+    return fallback;
+  }
+  char* end = nullptr;
+  long long parsed = std::strtoll(value, &end, 10);
+  if (*end != '\0' || parsed < 0 || static_cast<unsigned long long>(parsed) > max) {
+    std::fprintf(stderr, "%s=%s: expected an integer from 0 to %llu\n", name, value, static_cast<unsigned long long>(max));
+    std::exit(2);
+  }
+  return static_cast<uint64_t>(parsed);
+}
+
+// Comma-separated values; empty items are skipped
+inline std::vector<std::string> envList(const char* name) {
+  std::vector<std::string> items;
+  std::string value = envString(name, "");
+  size_t start = 0;
+  while (start <= value.size()) {
+    size_t comma = value.find(',', start);
+    if (comma == std::string::npos) {
+      comma = value.size();
+    }
+    if (comma > start) {
+      items.push_back(value.substr(start, comma - start));
+    }
+    start = comma + 1;
+  }
+  return items;
+}
@@ -0,0 +1,408 @@
+#include "raw_listener.h"
+#include "../logging/service_table.h"
+#include "../metrics/metrics.h"
+#include "../../include/errors/http_error.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <exception>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr size_t kReadBytes = 64 * 1024;                    // Also the largest UDP datagram
+constexpr int kUdpReceiveBuffer = 4 * 1024 * 1024;          // Absorbs bursts while the loop is busy; capped by net.core.rmem_max
+constexpr size_t kDatagramsPerWakeup = 64;
+
+struct TransportMetrics {
+  explicit TransportMetrics(const std::string& labels)
+    : records(MetricsRegistry::global().counter("logan_raw_ingest_records_total", "Records parsed by the raw listener", labels)),
+      malformed(MetricsRegistry::global().counter("logan_raw_ingest_malformed_total", "Raw lines skipped because they didn't parse or named a service past the limit", labels)) {}
+
+  Counter& records;
+  Counter& malformed;
+};
+
+struct RawMetrics {
+  TransportMetrics tcp{"transport=\"tcp\""};
+  TransportMetrics udp{"transport=\"udp\""};
+  Counter& rejected = MetricsRegistry::global().counter("logan_raw_ingest_rejected_records_total", "Raw records dropped because the file writer refused the batch");
+  Counter& refused = MetricsRegistry::global().counter("logan_raw_ingest_refused_connections_total", "TCP connections closed on accept because the listener was full");
+  Histogram& batches = MetricsRegistry::global().histogram("logan_raw_ingest_batch_seconds", "Time to hand one raw batch to the logger");
+};
+
+RawMetrics& metrics() {
+  static RawMetrics metrics;
+  return metrics;
+}
+
+bool isBlank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+std::string_view skipBlanks(std::string_view text) {
+  size_t start = 0;
+  while (start < text.size() && isBlank(text[start])) {
+    ++start;
+  }
+  return text.substr(start);
+}
+
+std::string_view nextToken(std::string_view& rest) {
+  rest = skipBlanks(rest);
+  size_t end = 0;
+  while (end < rest.size() && !isBlank(rest[end])) {
+    ++end;
+  }
+  std::string_view token = rest.substr(0, end);
+  rest.remove_prefix(end);
+  return token;
+}
+
+std::optional<LogLevel> levelOf(std::string_view name) {
+  static constexpr std::pair<std::string_view, LogLevel> kLevels[] = {
+    {"debug", LogLevel::Debug},
+    {"info", LogLevel::Info},
+    {"warn", LogLevel::Warn},
+    {"error", LogLevel::Error},
+    {"fatal", LogLevel::Fatal}
+  };
+  for (const auto& [text, level] : kLevels) {
+    if (std::equal(name.begin(), name.end(), text.begin(), text.end(), [](char a, char b) {
+          return std::tolower(static_cast<unsigned char>(a)) == b;
+        })) {
+      return level;
+    }
+  }
+  return std::nullopt;
+}
+
+// Well-formed UTF-8 without control characters other than tab, so a raw
+// record serializes to valid JSON like one that came in over HTTP
+bool isCleanText(std::string_view text) {
+  size_t pos = 0;
+  while (pos < text.size()) {
+    unsigned char c = static_cast<unsigned char>(text[pos]);
+    if (c < 0x80) {
+      if (c < 0x20 && c != '\t') {
+        return false;
+      }
+      ++pos;
+      continue;
+    }
+
+    size_t length;
+    uint32_t code;
+    if (c >= 0xc2 && c <= 0xdf) {
+      length = 2;
+      code = c & 0x1f;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      length = 3;
+      code = c & 0x0f;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      length = 4;
+      code = c & 0x07;
+    } else {
+      return false;                                         // Continuation byte, overlong lead or past U+10FFFF
+    }
+    if (text.size() - pos < length) {
+      return false;
+    }
+    for (size_t i = 1; i < length; ++i) {
+      unsigned char next = static_cast<unsigned char>(text[pos + i]);
+      if ((next & 0xc0) != 0x80) {
+        return false;
+      }
+      code = code << 6 | (next & 0x3f);
+    }
+    if ((length == 3 && (code < 0x800 || (code >= 0xd800 && code <= 0xdfff))) ||
+        (length == 4 && (code < 0x10000 || code > 0x10ffff))) {
+      return false;                                         // Overlong, surrogate or out of range
+    }
+    pos += length;
+  }
+  return true;
+}
+
+int openSocket(const std::string& host, int port, int type) {
+  int fd = ::socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  int one = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (type == SOCK_DGRAM) {
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &kUdpReceiveBuffer, sizeof(kUdpReceiveBuffer));
+  }
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16_t>(port));
+  if (::inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1 ||
+      ::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 ||
+      (type == SOCK_STREAM && ::listen(fd, SOMAXCONN) < 0)) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int64_t nowSeconds() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}
+
+std::optional<LogRecord> parseRawRecord(std::string_view line, int64_t now) {
+  if (!line.empty() && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+  if (!isCleanText(line)) {
+    return std::nullopt;
+  }
+
+  std::string_view rest = line;
+  std::string_view timestamp = nextToken(rest);
+  std::string_view service = nextToken(rest);
+  std::string_view level = nextToken(rest);
+  if (level.empty()) {
+    return std::nullopt;
+  }
+
+  LogRecord record;
+  if (timestamp == "-") {
+    record.timestamp = now;
+  } else {
+    auto [end, error] = std::from_chars(timestamp.data(), timestamp.data() + timestamp.size(), record.timestamp);
+    if (error != std::errc() || end != timestamp.data() + timestamp.size()) {
+      return std::nullopt;
+    }
+  }
+
+  auto parsedLevel = levelOf(level);
+  if (!parsedLevel || std::any_of(service.begin(), service.end(), [](unsigned char c) { return std::isspace(c); })) {
+    return std::nullopt;
+  }
+  record.level = parsedLevel.value();
+  record.service.assign(service);
+  auto serviceId = ServiceTable::global().tryIntern(service);
+  if (!serviceId) {
+    return std::nullopt;                                    // A new service past LOGAN_MAX_SERVICES
+  }
+  record.serviceId = serviceId.value();
+  record.message.assign(skipBlanks(rest));
+  return record;
+}
+
+RawListener::RawListener(Logger& logger, RawListenerOptions options)
+  : logger_(logger), options_(std::move(options)), connections_(0), running_(true) {
+  epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+  wake_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  std::string failure;
+  if (epoll_ < 0 || wake_ < 0) {
+    failure = "Failed to start the raw listener";
+  } else if (options_.tcpPort > 0 && (tcp_ = openSocket(options_.host, options_.tcpPort, SOCK_STREAM)) < 0) {
+    failure = "Failed to listen on TCP port " + std::to_string(options_.tcpPort);
+  } else if (options_.udpPort > 0 && (udp_ = openSocket(options_.host, options_.udpPort, SOCK_DGRAM)) < 0) {
+    failure = "Failed to listen on UDP port " + std::to_string(options_.udpPort);
+  }
+
+  for (int fd : {wake_, tcp_, udp_}) {
+    if (failure.empty() && fd >= 0) {
+      epoll_event event{};
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      ::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+    }
+  }
+
+  if (!failure.empty()) {
+    for (int fd : {epoll_, wake_, tcp_, udp_}) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+    throw HttpError(500, failure);
+  }
+
+  thread_ = std::thread(&RawListener::loop, this);
+}
+
+RawListener::~RawListener() {
+  shutdown();
+  for (int fd : {epoll_, wake_, tcp_, udp_}) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+}
+
+void RawListener::shutdown() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  uint64_t one = 1;
+  [[maybe_unused]] ssize_t written = ::write(wake_, &one, sizeof(one));
+  thread_.join();
+}
+
+size_t RawListener::connections() const {
+  return connections_.load(std::memory_order_relaxed);
+}
+
+void RawListener::loop() {
+  std::vector<epoll_event> events(64);
+  std::vector<char> buffer(kReadBytes);
+  std::unordered_map<int, std::string> pending;             // Unfinished line per open connection
+  std::vector<LogRecord> batch;
+  int64_t now = nowSeconds();
+
+  auto flush = [&] {
+    if (batch.empty()) {
+      return;
+    }
+    ScopedTimer timer(metrics().batches);
+    try {
+      logger_.logBatch(batch);
+    } catch (const std::exception&) {
+      metrics().rejected.add(batch.size());                 // Queue full or the write failed; nobody to tell but the metric
+    }
+    batch.clear();
+  };
+
+  auto accept = [&](std::string_view line, TransportMetrics& counters) {
+    if (line.empty() || (line.size() == 1 && line[0] == '\r')) {
+      return;
+    }
+    auto record = parseRawRecord(line, now);
+    if (!record) {
+      counters.malformed.add();
+      return;
+    }
+    counters.records.add();
+    batch.push_back(std::move(record.value()));
+    if (batch.size() >= options_.maxBatchRecords) {
+      flush();
+    }
+  };
+
+  // Takes every complete line of `data` and returns how many bytes that was
+  auto acceptLines = [&](std::string_view data, TransportMetrics& counters) {
+    size_t pos = 0;
+    for (size_t newline; (newline = data.find('\n', pos)) != std::string_view::npos; pos = newline + 1) {
+      accept(data.substr(pos, newline - pos), counters);
+    }
+    return pos;
+  };
+
+  auto close = [&](int fd) {
+    ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    pending.erase(fd);
+    connections_.store(pending.size(), std::memory_order_relaxed);
+  };
+
+  auto acceptConnections = [&] {
+    for (int fd; (fd = ::accept4(tcp_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0;) {
+      if (pending.size() >= options_.maxConnections) {
+        ::close(fd);
+        metrics().refused.add();
+        continue;
+      }
+      epoll_event event{};
+      event.events = EPOLLIN | EPOLLRDHUP;
+      event.data.fd = fd;
+      ::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+      pending.emplace(fd, std::string());
+      connections_.store(pending.size(), std::memory_order_relaxed);
+    }
+  };
+
+  // One read per wakeup, so a busy connection can't starve the others; the
+  // epoll is level-triggered and reports it again while data is left
+  auto readConnection = [&](int fd) {
+    auto found = pending.find(fd);
+    if (found == pending.end()) {
+      return;
+    }
+    std::string& rest = found->second;
+
+    ssize_t received = ::read(fd, buffer.data(), buffer.size());
+    if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+      return;
+    }
+    if (received <= 0) {
+      accept(rest, metrics().tcp);                          // A last line without its newline
+      close(fd);
+      return;
+    }
+
+    std::string_view data(buffer.data(), static_cast<size_t>(received));
+    if (rest.empty()) {
+      rest.assign(data.substr(acceptLines(data, metrics().tcp)));
+    } else {
+      rest.append(data);
+      rest.erase(0, acceptLines(rest, metrics().tcp));
+    }
+    if (rest.size() > options_.maxLineBytes) {
+      metrics().tcp.malformed.add();
+      close(fd);
+    }
+  };
+
+  auto readDatagrams = [&] {
+    for (size_t i = 0; i < kDatagramsPerWakeup; ++i) {
+      ssize_t received = ::recv(udp_, buffer.data(), buffer.size(), 0);
+      if (received < 0) {
+        return;
+      }
+      std::string_view data(buffer.data(), static_cast<size_t>(received));
+      accept(data.substr(acceptLines(data, metrics().udp)), metrics().udp);
+    }
+  };
+
+  while (running_.load(std::memory_order_relaxed)) {
+    int ready = ::epoll_wait(epoll_, events.data(), static_cast<int>(events.size()), -1);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    now = nowSeconds();
+    for (int i = 0; i < ready; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == wake_) {
+        continue;                                           // Only sent on shutdown
+      } else if (fd == tcp_) {
+        acceptConnections();
+      } else if (fd == udp_) {
+        readDatagrams();
+      } else {
+        readConnection(fd);
+      }
+    }
+    flush();
+  }
+
+  for (auto& [fd, rest] : pending) {
+    accept(rest, metrics().tcp);
+    ::close(fd);
+  }
+  pending.clear();
+  connections_.store(0, std::memory_order_relaxed);
+  flush();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "../logging/log_record.h"
+#include "../logging/logger.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+struct RawListenerOptions {
+  std::string host = "0.0.0.0";
+  int tcpPort = 0;                                          // 0 leaves TCP off
+  int udpPort = 0;                                          // 0 leaves UDP off
+  size_t maxConnections = 1024;                             // Further TCP connections are closed on accept
+  size_t maxLineBytes = 64 * 1024;                          // A connection sending a longer line is closed
+  size_t maxBatchRecords = 10000;                           // Handed to the logger at most at once
+};
+
+// Ingests newline-delimited records without HTTP or JSON:
+//   <timestamp|-> <service> <level> <message>\n
+// over persistent TCP connections and, optionally, UDP datagrams of one or
+// more lines. A `-` timestamp takes the server's clock. One epoll loop
+// serves every socket and hands each round's records to the logger as one
+// batch; while the file writer's queue is full that call blocks, so the
+// loop stops reading and TCP pushes back on the producers. Malformed lines
+// are counted and skipped, since there is no response to report them in.
+class RawListener {
+public:
+  // Binds the ports and starts the loop. Throws HttpError(500) if a port
+  // can't be bound.
+  RawListener(Logger& logger, RawListenerOptions options);
+  ~RawListener();
+
+  RawListener(const RawListener&) = delete;
+  RawListener& operator=(const RawListener&) = delete;
+
+  void shutdown();
+
+  size_t connections() const;
+
+private:
+  void loop();
+
+  Logger& logger_;
+  RawListenerOptions options_;
+  int epoll_ = -1;
+  int wake_ = -1;                                           // eventfd that interrupts epoll_wait on shutdown
+  int tcp_ = -1;
+  int udp_ = -1;
+  std::atomic<size_t> connections_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+};
+
+// One raw line, excluding the newline (a trailing '\r' is ignored). `now` is
+// used for a `-` timestamp. Lines that aren't valid UTF-8 or hold control
+// characters other than tab are malformed.
+std::optional<LogRecord> parseRawRecord(std::string_view line, int64_t now);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <cstddef>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -14,6 +15,8 @@ enum class LogLevel {
   Fatal
 };
 
+constexpr size_t kLogLevelCount = 5;
+
 inline std::string_view logLevelToString(LogLevel level) {
   switch (level) {
     case LogLevel::Debug: return "DEBUG";
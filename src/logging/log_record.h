@@ -1,11 +1,33 @@
 #pragma once
 
 #include "log_level.h"
+#include "service_table.h"
 #include <string>
+#include <string_view>
 
 struct LogRecord {
   int64_t timestamp;
   std::string service;
   LogLevel level;
   std::string message;
+  ServiceId serviceId = kNoServiceId;                       // Interned `service`, set at ingestion
 };
+
+// Interned id of the record's service, interning it if ingestion didn't
+inline ServiceId serviceIdOf(const LogRecord& record) {
+  return record.serviceId != kNoServiceId ? record.serviceId : ServiceTable::global().intern(record.service);
+}
+
+// A record as read back by a query. The views point into the mapped segment,
+// the service table or a per-query arena, and are only valid until the
+// visitor returns.
+struct LogRecordView {
+  int64_t timestamp;
+  std::string_view service;
+  LogLevel level;
+  std::string_view message;
+};
+
+inline LogRecord toRecord(const LogRecordView& view) {
+  return LogRecord{view.timestamp, std::string(view.service), view.level, std::string(view.message)};
+}
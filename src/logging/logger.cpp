@@ -7,8 +7,29 @@ void Logger::addSink(const std::shared_ptr<Sink>& sink) {
   sinks_.push_back(sink);
 }
 
+void Logger::addSink(const std::shared_ptr<Sink>& sink, const AsyncSinkOptions& options) {
+  sinks_.push_back(std::make_shared<AsyncSink>(sink, options));
+}
+
 void Logger::log(const LogRecord& record) {
-  for (const auto& sink : sinks_) {
-    sink->write(record);
+  if (!sinks_.front()->write(record)) {
+    return;
+  }
+  for (size_t i = 1; i < sinks_.size(); ++i) {
+    sinks_[i]->write(record);
+  }
+}
+
+void Logger::logBatch(const std::vector<LogRecord>& records) {
+  if (records.empty()) {
+    return;
+  }
+  // Which part of a partly dropped batch was taken is not known, so none of
+  // it is passed on
+  if (sinks_.front()->writeBatch(records) != records.size()) {
+    return;
+  }
+  for (size_t i = 1; i < sinks_.size(); ++i) {
+    sinks_[i]->writeBatch(records);
   }
 }
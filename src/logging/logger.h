@@ -3,14 +3,21 @@
 #include <vector>
 #include <memory>
 #include "log_record.h"
+#include "../sink/async_sink.h"
 #include "../sink/sink.h"
 
+// Hands records to every sink in turn. The first sink (the file writer) is
+// called inline so its errors reach the client; others that may be slow are
+// added with AsyncSinkOptions and get their own queue and thread. Records the
+// first sink drops are not passed to the others.
 class Logger {
 public:
   Logger(const std::shared_ptr<Sink>& sink);
   void addSink(const std::shared_ptr<Sink>& sink);
+  void addSink(const std::shared_ptr<Sink>& sink, const AsyncSinkOptions& options);
   
   void log(const LogRecord& record);
+  void logBatch(const std::vector<LogRecord>& records);
 
 private:
   std::vector<std::shared_ptr<Sink>> sinks_;
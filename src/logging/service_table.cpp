@@ -0,0 +1,67 @@
+#include "service_table.h"
+#include <mutex>
+
+ServiceTable& ServiceTable::global() {
+  static ServiceTable table;
+  return table;
+}
+
+ServiceId ServiceTable::intern(std::string_view name) {
+  return intern(name, false).value();
+}
+
+std::optional<ServiceId> ServiceTable::tryIntern(std::string_view name) {
+  return intern(name, true);
+}
+
+std::optional<ServiceId> ServiceTable::intern(std::string_view name, bool bounded) {
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = ids_.find(name);
+    if (it != ids_.end()) {
+      return it->second;
+    }
+  }
+
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto it = ids_.find(name);
+  if (it != ids_.end()) {
+    return it->second;                                      // Interned by another thread in between
+  }
+  if (bounded && names_.size() >= limit_) {
+    return std::nullopt;
+  }
+  auto id = static_cast<ServiceId>(names_.size());
+  names_.emplace_back(name);
+  ids_.emplace(names_.back(), id);
+  return id;
+}
+
+std::optional<ServiceId> ServiceTable::find(std::string_view name) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = ids_.find(name);
+  if (it == ids_.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+std::string_view ServiceTable::name(ServiceId id) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return id < names_.size() ? std::string_view(names_[id]) : std::string_view();
+}
+
+size_t ServiceTable::size() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return names_.size();
+}
+
+void ServiceTable::setLimit(size_t limit) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  limit_ = limit;
+}
+
+size_t ServiceTable::limit() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return limit_;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using ServiceId = uint32_t;
+
+constexpr ServiceId kNoServiceId = UINT32_MAX;
+
+// Process-wide intern table of service names. Ids are dense and never reused,
+// and the views handed out by name() stay valid for the life of the process.
+// Names are never removed, so client input goes through tryIntern(), which
+// stops adding names at a limit; intern() is for names already on disk.
+class ServiceTable {
+public:
+  static ServiceTable& global();
+
+  ServiceId intern(std::string_view name);
+  // nullopt if `name` is new and the table already holds `limit` names
+  std::optional<ServiceId> tryIntern(std::string_view name);
+  std::optional<ServiceId> find(std::string_view name) const;
+  std::string_view name(ServiceId id) const;
+  size_t size() const;
+
+  void setLimit(size_t limit);
+  size_t limit() const;
+
+private:
+  std::optional<ServiceId> intern(std::string_view name, bool bounded);
+
+  mutable std::shared_mutex mutex_;
+  size_t limit_ = std::numeric_limits<size_t>::max();
+  std::deque<std::string> names_;                           // Deque, so interned strings never move
+  std::unordered_map<std::string_view, ServiceId> ids_;     // Keys view into `names_`
+};
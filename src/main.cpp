@@ -1,18 +1,31 @@
 #include <iostream>
 #include <memory>
+#include <cctype>
 #include <csignal>
+#include <limits>
 #include <optional>
+#include <sstream>
 #include "../third_party/httplib.h"
 #include "../third_party/nlohmann/json.hpp"
 #include "../include/errors/http_error.h"
+#include "config/env.h"
+#include "ingest/raw_listener.h"
 #include "logging/log_level.h"
 #include "logging/log_record.h"
 #include "logging/logger.h"
+#include "metrics/metrics.h"
 #include "sink/file_sink.h"
+#include "sink/sharded_sink.h"
 #include "sink/console_sink.h"
+#include "sink/tail_sink.h"
 #include "querying/query_params.h"
 #include "querying/querier.h"
+#include "querying/aggregator.h"
+#include "querying/rollup_store.h"
+#include "querying/text_match.h"
 #include "source/file_source.h"
+#include "source/memory_source.h"
+#include "serialization/json_writer.h"
 
 #ifndef BUILD_DIR 							// To remove warnings. BUILD_DIR is set from CMakeLists.txt
 #define BUILD_DIR "./build"
@@ -20,6 +33,16 @@
 
 using json = nlohmann::json;
 
+constexpr size_t kStreamFlushBytes = 64 * 1024;
+constexpr size_t kMaxBatchRecords = 10000;
+constexpr size_t kMaxOrderedLimit = 10000;
+constexpr auto kTailPollInterval = std::chrono::milliseconds(500);
+constexpr auto kTailKeepAlive = std::chrono::seconds(15);
+// Bounds for durations from the environment, far from overflowing the clocks
+// they are added to
+constexpr uint64_t kMaxEnvMillis = 24 * 3600 * 1000;
+constexpr uint64_t kMaxEnvSeconds = 10ull * 365 * 86400;
+
 std::atomic<bool> shutdownRequested{false};
 
 void handleSignal(int sig) {
@@ -32,75 +55,578 @@ void installSignalHandlers() {
 	std::signal(SIGQUIT, handleSignal);
 }
 
+// Validates one JSON log entry, throwing HttpError(400) on the first problem
+LogRecord parseLogRecord(const json& body) {
+	if (!body.is_object()) {
+		throw HttpError(400, "Log entry should be a JSON object");
+	} else if (!body.contains("service")) {
+		throw HttpError(400, "Service is required, but it is missing in body");
+	} else if (!body.contains("level")) {
+		throw HttpError(400, "Level is required, but it is missing in body");
+	} else if (!body.contains("message")) {
+		throw HttpError(400, "Message is required, but it is missing in body");
+	} else if (!body.contains("timestamp")) {
+		throw HttpError(400, "Timestamp is required, but it is missing in body");
+	} else if (!body["timestamp"].is_number_integer()) {
+		throw HttpError(400, "Timestamp should be an integer");
+	} else if (!body["service"].is_string() || !body["level"].is_string() || !body["message"].is_string()) {
+		throw HttpError(400, "Service, level and message should be strings");
+	}
+
+	LogRecord record;
+	record.timestamp = body["timestamp"].get<int64_t>();
+	record.service = body["service"];
+	record.message = body["message"];
+	std::string level = body["level"];
+	std::transform(level.begin(), level.end(), level.begin(), [](unsigned char c) {
+		return std::tolower(c);
+	});
+	
+	if (level == "info") {
+		record.level = LogLevel::Info;
+	} else if (level == "debug") {
+		record.level = LogLevel::Debug;
+	} else if (level == "warn") {
+		record.level = LogLevel::Warn;
+	} else if (level == "error") {
+		record.level = LogLevel::Error;
+	} else if (level == "fatal") {
+		record.level = LogLevel::Fatal;
+	} else {
+		throw HttpError(400, "Invalid level");
+	}
+
+	if (record.service.empty() || std::any_of(record.service.begin(), record.service.end(), [](unsigned char c) { return std::isspace(c); })) {
+		throw HttpError(400, "Service should be a non-empty name without whitespace");
+	}
+	auto service = ServiceTable::global().tryIntern(record.service);
+	if (!service) {
+		throw HttpError(422, "Too many distinct services, the limit is " + std::to_string(ServiceTable::global().limit()));
+	}
+	record.serviceId = service.value();
+
+	return record;
+}
+
+// Reads the record filters shared by GET /log and GET /log/stats
+QueryParams parseQueryFilters(const httplib::Request& req) {
+	QueryParams params;
+
+	if (req.has_param("service")) {
+		params.service = req.get_param_value("service");
+	}
+
+	if (req.has_param("level")) {
+		auto lvl = req.get_param_value("level");
+		std::transform(lvl.begin(), lvl.end(), lvl.begin(), ::tolower);
+
+		if (lvl == "info") params.level = LogLevel::Info;
+		else if (lvl == "debug") params.level = LogLevel::Debug;
+		else if (lvl == "warn") params.level = LogLevel::Warn;
+		else if (lvl == "error") params.level = LogLevel::Error;
+		else if (lvl == "fatal") params.level = LogLevel::Fatal;
+		else throw HttpError(400, "Invalid level");
+	}
+
+	if (req.has_param("from")) {
+		params.from = std::stoll(req.get_param_value("from"));
+	}
+
+	if (req.has_param("to")) {
+		params.to = std::stoll(req.get_param_value("to"));
+	}
+
+	if (params.from && params.to && params.from > params.to) {
+		throw HttpError(400, "\"From\" parameter should be less than \"To\" parameter");
+	}
+
+	if (req.has_param("q") && !req.get_param_value("q").empty()) {
+		params.contains = req.get_param_value("q");
+	}
+
+	if (req.has_param("re")) {
+		params.regex = req.get_param_value("re");
+		if (auto error = regexError(params.regex.value())) {
+			throw HttpError(400, error.value());
+		}
+	}
+
+	return params;
+}
+
+// Parses a positive record count; anything else, including trailing
+// characters or a value out of range, is nullopt
+std::optional<size_t> parseLimit(const std::string& text) {
+	if (text.empty() || !std::isdigit(static_cast<unsigned char>(text.front()))) {
+		return std::nullopt;
+	}
+
+	size_t consumed = 0;
+	long long value = 0;
+	try {
+		value = std::stoll(text, &consumed);
+	} catch (const std::exception&) {
+		return std::nullopt;
+	}
+
+	if (consumed != text.size() || value <= 0) {
+		return std::nullopt;
+	}
+	return static_cast<size_t>(value);
+}
+
+// Parses a bucket width such as "60", "60s", "5m", "1h" or "1d" into seconds
+std::optional<int64_t> parseBucket(const std::string& text) {
+	size_t consumed = 0;
+	long long value = 0;
+	try {
+		value = std::stoll(text, &consumed);
+	} catch (const std::exception&) {
+		return std::nullopt;
+	}
+
+	std::string unit = text.substr(consumed);
+	int64_t scale = 0;
+	if (unit.empty() || unit == "s") scale = 1;
+	else if (unit == "m") scale = 60;
+	else if (unit == "h") scale = 3600;
+	else if (unit == "d") scale = 86400;
+
+	int64_t seconds = 0;
+	if (scale == 0 || value <= 0 || __builtin_mul_overflow(value, scale, &seconds)) {
+		return std::nullopt;
+	}
+	return seconds;
+}
+
 int main() {
 	installSignalHandlers();
 	
 	httplib::Server server;
+	server.set_tcp_nodelay(true);                             // Responses go out in several writes; don't let Nagle hold the last one back
+
+	// Every connection, and every open tail stream for as long as it lasts,
+	// occupies one of these workers. Tails are capped at half of them at most
+	// (a quarter by default) so they can't lock out ingestion and queries.
+	size_t httpThreads = static_cast<size_t>(envSize("LOGAN_HTTP_THREADS", std::max(16u, 2 * std::thread::hardware_concurrency()), 4096));
+	httpThreads = std::max<size_t>(httpThreads, 2);
+	server.new_task_queue = [httpThreads] {
+		return new httplib::ThreadPool(httpThreads);
+	};
 
-	auto fileSink = std::make_shared<FileSink>(std::string(BUILD_DIR) + "/logs.txt");
+	FileSinkOptions sinkOptions;
+	sinkOptions.queueCapacity = static_cast<size_t>(envSize("LOGAN_QUEUE_CAPACITY", sinkOptions.queueCapacity, size_t{1} << 30));
+	sinkOptions.blockTimeout = std::chrono::milliseconds(envSize("LOGAN_BLOCK_TIMEOUT_MS", sinkOptions.blockTimeout.count(), kMaxEnvMillis));
+	std::string overflow = envString("LOGAN_OVERFLOW_POLICY", "block");
+	if (overflow == "drop") {
+		sinkOptions.overflowPolicy = OverflowPolicy::DropNewest;
+	} else if (overflow == "reject") {
+		sinkOptions.overflowPolicy = OverflowPolicy::Reject;
+	}
+
+	std::string durability = envString("LOGAN_DURABILITY", "interval");
+	if (durability == "none") {
+		sinkOptions.durability = Durability::None;
+	} else if (durability == "group-commit") {
+		sinkOptions.durability = Durability::GroupCommit;
+	}
+	sinkOptions.syncInterval = std::chrono::milliseconds(envSize("LOGAN_SYNC_INTERVAL_MS", sinkOptions.syncInterval.count(), kMaxEnvMillis));
+
+	if (envString("LOGAN_STORAGE_FORMAT", "text") == "block") {
+		sinkOptions.format = StorageFormat::Block;
+	}
+	sinkOptions.trigramIndex = envInt("LOGAN_TRIGRAM_INDEX", 0) != 0;
+	sinkOptions.maxSegmentBytes = envSize("LOGAN_SEGMENT_BYTES", sinkOptions.maxSegmentBytes);
+	sinkOptions.maxSegmentAge = std::chrono::seconds(envSize("LOGAN_SEGMENT_SECONDS", sinkOptions.maxSegmentAge.count(), kMaxEnvSeconds));
+	sinkOptions.retentionAge = std::chrono::seconds(envSize("LOGAN_RETENTION_SECONDS", 0, kMaxEnvSeconds));
+	sinkOptions.retentionBytes = envSize("LOGAN_RETENTION_BYTES", 0);
+	sinkOptions.compaction = envInt("LOGAN_COMPACTION", 0) != 0;
+	sinkOptions.maintenanceInterval = std::chrono::seconds(envSize("LOGAN_MAINTENANCE_SECONDS", sinkOptions.maintenanceInterval.count(), kMaxEnvSeconds));
+
+	// Each shard has its own writer thread and directory. By default shard 0
+	// writes to logs/ and the others to logs/shard-N; LOGAN_SHARD_DIRS puts
+	// them anywhere, e.g. one per disk.
+	std::string logRoot = std::string(BUILD_DIR) + "/logs";
+	size_t shards = static_cast<size_t>(std::max<uint64_t>(envSize("LOGAN_SHARDS", 1, 256), 1));
+	std::vector<std::string> shardDirs = envList("LOGAN_SHARD_DIRS");
+	std::vector<std::string> sourceDirs = shardDirs;
+	if (shardDirs.empty()) {
+		shardDirs = shardDirectories(logRoot, shards);
+		sourceDirs = readableShardDirectories(logRoot, shards);
+	}
+	// Interned service names are never freed, so clients can't add new ones
+	// past this limit; names already in the segments always count
+	ServiceTable::global().setLimit(static_cast<size_t>(envSize("LOGAN_MAX_SERVICES", 10000)));
+
+	ShardRouting routing = envString("LOGAN_SHARD_ROUTING", "thread") == "service" ? ShardRouting::Service : ShardRouting::Thread;
+
+	auto rollups = std::make_shared<RollupStore>(static_cast<int64_t>(envSize("LOGAN_ROLLUP_SECONDS", 60, kMaxEnvSeconds)));
+	auto fileSink = std::make_shared<ShardedSink>(shardDirs, sinkOptions, rollups, routing);
 	auto consoleSink = std::make_shared<ConsoleSink>();
+
+	TailSinkOptions tailOptions;
+	tailOptions.bufferRecords = static_cast<size_t>(envSize("LOGAN_TAIL_BUFFER", tailOptions.bufferRecords));
+	tailOptions.maxSubscribers = static_cast<size_t>(envSize("LOGAN_TAIL_MAX_SUBSCRIBERS", httpThreads / 4, httpThreads / 2));
+	if (envString("LOGAN_TAIL_OVERFLOW", "drop") == "disconnect") {
+		tailOptions.overflow = TailOverflow::Disconnect;
+	}
+	auto tailSink = std::make_shared<TailSink>(tailOptions);
+
+	MemorySourceOptions hotOptions;
+	hotOptions.maxBytes = envSize("LOGAN_HOT_BYTES", hotOptions.maxBytes);
+	hotOptions.window = std::chrono::seconds(envSize("LOGAN_HOT_WINDOW_SECONDS", hotOptions.window.count(), kMaxEnvSeconds));
+	auto hotTier = std::make_shared<MemorySource>(hotOptions);
+
+	// The console gets its own queue and thread: a slow terminal or pipe drops
+	// console lines instead of slowing ingestion
+	AsyncSinkOptions consoleOptions;
+	consoleOptions.queueCapacity = static_cast<size_t>(envSize("LOGAN_CONSOLE_QUEUE", consoleOptions.queueCapacity, size_t{1} << 30));
+	consoleOptions.sampleRate = envSize("LOGAN_CONSOLE_SAMPLE_PERCENT", 100, 100) / 100.0;
+	if (envString("LOGAN_CONSOLE_OVERFLOW", "drop") == "block") {
+		consoleOptions.overflow = AsyncOverflow::Block;
+	}
+
 	Logger logger(fileSink);
-	logger.addSink(consoleSink);
+	if (consoleOptions.sampleRate > 0) {
+		logger.addSink(consoleSink, consoleOptions);
+	}
+	logger.addSink(tailSink);
+	// The hot tier is fed by the shards rather than the logger, so it only
+	// holds records they queued and never serves dropped or rejected ones
+	fileSink->setAcceptedSink(hotTier);
+
+	FileSourceOptions sourceOptions;
+	sourceOptions.scanThreads = static_cast<size_t>(envSize("LOGAN_SCAN_THREADS", 0, 1024));
+	sourceOptions.parallelScanThreshold = envSize("LOGAN_PARALLEL_SCAN_BYTES", sourceOptions.parallelScanThreshold);
+	sourceOptions.scanChunkBytes = envSize("LOGAN_SCAN_CHUNK_BYTES", sourceOptions.scanChunkBytes);
+	sourceOptions.resultCacheBytes = static_cast<size_t>(envSize("LOGAN_RESULT_CACHE_BYTES", sourceOptions.resultCacheBytes));
+	sourceOptions.resultCacheEntries = static_cast<size_t>(envSize("LOGAN_RESULT_CACHE_ENTRIES", sourceOptions.resultCacheEntries));
+
+	// One FileSource per shard directory. They share the scan workers and
+	// split the result cache.
+	std::shared_ptr<ThreadPool> scanPool;
+	if (sourceOptions.scanThreads != 1) {
+		scanPool = std::make_shared<ThreadPool>(sourceOptions.scanThreads);
+	}
+	sourceOptions.resultCacheBytes /= sourceDirs.size();
+	std::vector<std::shared_ptr<FileSource>> fileSources;
+	for (const auto& directory : sourceDirs) {
+		fileSources.push_back(std::make_shared<FileSource>(directory, sourceOptions, scanPool));
+	}
+
+	Querier querier(fileSources.front());
+	for (size_t i = 1; i < fileSources.size(); ++i) {
+		querier.addSource(fileSources[i]);
+	}
+	querier.setHotTier(hotTier);
 
-	auto fileSource = std::make_shared<FileSource>(std::string(BUILD_DIR) + "/logs.txt");
-	Querier querier(fileSource);
+	// One pass over the segments rebuilds the rollups, and a second over the
+	// hot window warms the hot tier; the sinks keep both current from here on.
+	// Warming only the window keeps shards read one after another from
+	// filling memory with records that would be evicted right away.
+	int64_t newest = std::numeric_limits<int64_t>::min();
+	for (const auto& source : fileSources) {
+		source->scan(QueryParams{}, [&](const LogRecordView& log) {
+			rollups->add(log);
+			newest = std::max(newest, log.timestamp);
+			return true;
+		});
+	}
+	fileSink->setRetiredDirectories(std::vector<std::string>(sourceDirs.begin() + shardDirs.size(), sourceDirs.end()));
+	fileSink->startMaintenance();
+
+	QueryParams recent;
+	if (hotOptions.window.count() > 0 && newest != std::numeric_limits<int64_t>::min()) {
+		recent.from = newest - hotOptions.window.count();
+		hotTier->markCoveredFrom(recent.from.value());
+	}
+	for (const auto& source : fileSources) {
+		source->scan(recent, [&](const LogRecordView& log) {
+			hotTier->add(log);
+			return true;
+		});
+	}
+	Aggregator aggregator(rollups, querier);
+
+	auto& registry = MetricsRegistry::global();
+	Counter& ingestedRecords = registry.counter("logan_ingest_records_total", "Records accepted by POST /log and /log/batch");
+	Counter& ingestErrors = registry.counter("logan_ingest_errors_total", "Ingest requests answered with an error status");
+	Histogram& ingestLatency = registry.histogram("logan_ingest_request_seconds", "Time to handle one ingest request");
+	Counter& returnedRecords = registry.counter("logan_query_returned_records_total", "Records returned by GET /log");
+	Counter& responseBytes = registry.counter("logan_query_response_bytes_total", "Serialized GET /log response bytes");
+	Histogram& queryLatency = registry.histogram("logan_query_seconds", "Time to scan, serialize and send one GET /log response");
+	Histogram& responseWrites = registry.histogram("logan_query_write_seconds", "Time to hand one serialized response chunk to the connection");
+	Histogram& statsLatency = registry.histogram("logan_stats_seconds", "Time to answer one GET /log/stats");
+
+	registry.callback("logan_sink_queue_depth", "Records queued ahead of the file writer", MetricType::Gauge, [&fileSink] {
+		return static_cast<double>(fileSink->queueDepth());
+	});
+	registry.callback("logan_sink_queue_capacity", "Capacity of the file writer queue", MetricType::Gauge, [&fileSink] {
+		return static_cast<double>(fileSink->queueCapacity());
+	});
+	registry.callback("logan_sink_dropped_records_total", "Records dropped because the queue was full", MetricType::Counter, [&fileSink] {
+		return static_cast<double>(fileSink->droppedRecords());
+	});
+	registry.callback("logan_hot_tier_records", "Records held by the in-memory hot tier", MetricType::Gauge, [&hotTier] {
+		return static_cast<double>(hotTier->records());
+	});
+	registry.callback("logan_hot_tier_bytes", "Bytes held by the in-memory hot tier", MetricType::Gauge, [&hotTier] {
+		return static_cast<double>(hotTier->bytes());
+	});
 
-	server.Get("/health", [](const httplib::Request&, httplib::Response& res) {
+	server.Get("/metrics", [&registry](const httplib::Request&, httplib::Response& res) {
+		res.set_content(registry.render(), "text/plain; version=0.0.4");
+	});
+
+	server.Get("/health", [&fileSink, &hotTier](const httplib::Request&, httplib::Response& res) {
 		json health {
-			{"status", "ok"}
+			{"status", "ok"},
+			{"file_sink", {
+				{"shards", fileSink->shardCount()},
+				{"queue_depth", fileSink->queueDepth()},
+				{"queue_capacity", fileSink->queueCapacity()},
+				{"dropped", fileSink->droppedRecords()}
+			}},
+			{"hot_tier", {
+				{"records", hotTier->records()},
+				{"bytes", hotTier->bytes()},
+				{"covered_from", hotTier->coveredFrom()}
+			}}
 		};
 		res.set_content(health.dump(), "application/json");
 	});
 
-	server.Get("/log", [&querier](const httplib::Request& req, httplib::Response& res) {
+	server.Get("/log", [&querier, &returnedRecords, &responseBytes, &queryLatency, &responseWrites](const httplib::Request& req, httplib::Response& res) {
 		try {
-			QueryParams params;
+			QueryParams params = parseQueryFilters(req);
+
+			if (req.has_param("limit")) {
+				params.limit = parseLimit(req.get_param_value("limit"));
+				if (!params.limit) {
+					throw HttpError(400, "Limit should be a positive integer");
+				}
+			}
 
-			if (req.has_param("service")) {
-				params.service = req.get_param_value("service");
+			if (req.has_param("cursor")) {
+				params.cursor = QueryCursor::decode(req.get_param_value("cursor"));
+				if (!params.cursor) {
+					throw HttpError(400, "Invalid cursor");
+				}
 			}
 
-			if (req.has_param("level")) {
-				auto lvl = req.get_param_value("level");
-				std::transform(lvl.begin(), lvl.end(), lvl.begin(), ::tolower);
+			if (req.has_param("order")) {
+				std::string order = req.get_param_value("order");
+				if (order == "asc") params.order = SortOrder::Asc;
+				else if (order == "desc") params.order = SortOrder::Desc;
+				else throw HttpError(400, "Order should be asc or desc");
+
+				if (params.cursor) {
+					throw HttpError(400, "Ordered queries don't take a cursor; narrow from/to instead");
+				}
+				if (!params.limit || params.limit.value() > kMaxOrderedLimit) {
+					throw HttpError(400, "Ordered queries need a limit of at most " + std::to_string(kMaxOrderedLimit));
+				}
+			}
+			querier.checkCursor(params);
+
+			// NDJSON puts one record per line and, if the page was cut short, a
+			// final {"next_cursor":...} line
+			bool ndjson = req.get_header_value("Accept").find("application/x-ndjson") != std::string::npos;
+
+			// Records are written out as the sources produce them, so memory per
+			// query stays bounded however many records match
+			res.set_chunked_content_provider(ndjson ? "application/x-ndjson" : "application/json", [&querier, &returnedRecords, &responseBytes, &queryLatency, &responseWrites, params, ndjson](size_t, httplib::DataSink& sink) {
+				ScopedTimer timer(queryLatency);
+				size_t count = 0;
+				size_t bytes = 0;
+
+				// Timing each record would cost about as much as serializing it, so
+				// only whole chunks handed to the connection are timed
+				auto write = [&](const std::string& chunk) {
+					ScopedTimer writeTimer(responseWrites);
+					bytes += chunk.size();
+					return sink.write(chunk.data(), chunk.size());
+				};
+
+				try {
+					std::string buffer;
+					buffer.reserve(kStreamFlushBytes + 4096);
+					if (!ndjson) {
+						buffer += "{\"success\":true,\"logs\":[";
+					}
+					bool connected = true;
+
+					auto resume = querier.scan(params, [&](const LogRecordView& log) {
+						if (!ndjson && count > 0) {
+							buffer += ',';
+						}
+						++count;
+						appendJsonRecord(buffer, log);
+						if (ndjson) {
+							buffer += '\n';
+						}
 
-				if (lvl == "info") params.level = LogLevel::Info;
-				else if (lvl == "debug") params.level = LogLevel::Debug;
-				else if (lvl == "warn") params.level = LogLevel::Warn;
-				else if (lvl == "error") params.level = LogLevel::Error;
-				else if (lvl == "fatal") params.level = LogLevel::Fatal;
-				else throw HttpError(400, "Invalid level");
+						if (buffer.size() >= kStreamFlushBytes) {
+							connected = write(buffer);
+							buffer.clear();
+						}
+						return connected;
+					});
+
+					returnedRecords.add(count);
+					if (!connected) {
+						responseBytes.add(bytes);
+						return false;
+					}
+
+					if (ndjson) {
+						if (resume) {
+							buffer += "{\"next_cursor\":\"" + resume->encode() + "\"}\n";
+						}
+					} else {
+						buffer += "],\"count\":" + std::to_string(count);
+						if (resume) {
+							buffer += ",\"next_cursor\":\"" + resume->encode() + "\"";
+						}
+						buffer += '}';
+					}
+
+					write(buffer);
+					sink.done();
+					responseBytes.add(bytes);
+					return true;
+				} catch (const std::exception&) {
+					return false;                            // Headers are already sent; drop the connection
+				}
+			});
+		} catch (const HttpError& e) {
+			res.status = e.status();
+			res.set_content(
+				json {
+					{ "success", "false" },
+					{ "error", e.what() }
+				}.dump(),
+				"application/json"
+			);
+		} catch (const std::exception& e) {
+			res.status = 500;
+			res.set_content(
+				json{{"error", "Internal server error"}}.dump(),
+				"application/json"
+			);
+		}
+	});
+
+	server.Get("/log/stats", [&aggregator, &statsLatency](const httplib::Request& req, httplib::Response& res) {
+		ScopedTimer timer(statsLatency);
+		try {
+			StatsParams params;
+			params.filter = parseQueryFilters(req);
+
+			if (req.has_param("group_by")) {
+				std::stringstream fields(req.get_param_value("group_by"));
+				std::string field;
+				while (std::getline(fields, field, ',')) {
+					if (field == "service") params.byService = true;
+					else if (field == "level") params.byLevel = true;
+					else throw HttpError(400, "group_by accepts service and level");
+				}
 			}
 
-			if (req.has_param("from")) {
-				params.from = std::stoll(req.get_param_value("from"));
+			if (req.has_param("bucket")) {
+				params.bucket = parseBucket(req.get_param_value("bucket"));
+				if (!params.bucket) {
+					throw HttpError(400, "Invalid bucket");
+				}
 			}
 
-			if (req.has_param("to")) {
-				params.to = std::stoll(req.get_param_value("to"));
+			json stats = json::array();
+			for (const auto& row : aggregator.aggregate(params)) {
+				json entry;
+				if (row.bucket) entry["timestamp"] = row.bucket.value();
+				if (row.service) entry["service"] = row.service.value();
+				if (row.level) entry["level"] = logLevelToString(row.level.value());
+				entry["count"] = row.count;
+				stats.push_back(std::move(entry));
 			}
 
-			if (params.from && params.to && params.from > params.to) {
-				throw HttpError(400, "\"From\" parameter should be less than \"To\" parameter");
+			json response {
+				{"success", true},
+				{"stats", stats}
+			};
+			if (params.bucket) {
+				response["bucket"] = params.bucket.value();
 			}
+			res.set_content(response.dump(), "application/json");
+		} catch (const HttpError& e) {
+			res.status = e.status();
+			res.set_content(
+				json {
+					{ "success", "false" },
+					{ "error", e.what() }
+				}.dump(),
+				"application/json"
+			);
+		} catch (const std::exception& e) {
+			res.status = 500;
+			res.set_content(
+				json{{"error", "Internal server error"}}.dump(),
+				"application/json"
+			);
+		}
+	});
 
-			std::vector<LogRecord> logs = querier.query(params);
+	server.Get("/log/tail", [&tailSink](const httplib::Request& req, httplib::Response& res) {
+		try {
+			QueryParams filter = parseQueryFilters(req);
+			bool sse = req.get_header_value("Accept").find("text/event-stream") != std::string::npos;
+			auto subscription = tailSink->subscribe(filter);
 
-			json response;
-			response["success"] = true;
-			response["count"] = logs.size();
-			response["logs"] = json::array();
+			// Streams until the client goes away or the server shuts down. SSE
+			// sends a record per `data:` event, otherwise one record per line.
+			res.set_header("Cache-Control", "no-cache");
+			res.set_chunked_content_provider(sse ? "text/event-stream" : "application/x-ndjson", [subscription, sse](size_t, httplib::DataSink& sink) {
+				std::vector<LogRecord> records;
+				std::string buffer;
+				auto lastWrite = std::chrono::steady_clock::now();
 
-			for (const auto& log : logs) {
-				response["logs"].push_back({
-					{"timestamp", log.timestamp},
-					{"service", log.service},
-					{"level", logLevelToString(log.level)},
-					{"message", log.message}
-				});
-			}
+				while (true) {
+					records.clear();
+					buffer.clear();
+					uint64_t dropped = 0;
+					if (!subscription->take(records, dropped, kTailPollInterval)) {
+						sink.done();
+						return true;
+					}
 
-			res.set_content(response.dump(), "application/json");
+					if (dropped > 0) {
+						std::string notice = "{\"dropped\":" + std::to_string(dropped) + "}";
+						buffer += sse ? "event: dropped\ndata: " + notice + "\n\n" : notice + "\n";
+					}
+					for (const auto& record : records) {
+						if (sse) buffer += "data: ";
+						appendJsonRecord(buffer, LogRecordView{record.timestamp, record.service, record.level, record.message});
+						buffer += sse ? "\n\n" : "\n";
+					}
+
+					auto now = std::chrono::steady_clock::now();
+					if (buffer.empty()) {
+						if (!sink.is_writable()) {
+							return false;                    // Client went away while idle
+						}
+						if (!sse || now - lastWrite < kTailKeepAlive) {
+							continue;
+						}
+						buffer = ": keepalive\n\n";
+					}
+					if (!sink.write(buffer.data(), buffer.size())) {
+						return false;
+					}
+					lastWrite = now;
+				}
+			}, [tailSink, subscription](bool) {
+				tailSink->unsubscribe(subscription);
+			});
 		} catch (const HttpError& e) {
 			res.status = e.status();
 			res.set_content(
@@ -119,59 +645,125 @@ int main() {
 		}
 	});
 
-	server.Post("/log", [&logger](const httplib::Request& req, httplib::Response& res) {
+	server.Post("/log", [&logger, &ingestedRecords, &ingestErrors, &ingestLatency](const httplib::Request& req, httplib::Response& res) {
+		ScopedTimer timer(ingestLatency);
 		try {
 			if (req.get_header_value("Content-Type") != "application/json") {
 				throw HttpError(415, "Expected application/json");
 			}
 
 			json body = json::parse(req.body);
-			
-			if (!body.contains("service")) {
-				throw HttpError(400, "Service is required, but it is missing in body");
-			} else if (!body.contains("level")) {
-				throw HttpError(400, "Level is required, but it is missing in body");
-			} else if (!body.contains("message")) {
-				throw HttpError(400, "Message is required, but it is missing in body");
-			} else if (!body.contains("timestamp")) {
-				throw HttpError(400, "Timestamp is required, but it is missing in body");
-			} else if (!body["timestamp"].is_number_integer()) {
-				throw HttpError(400, "Timestamp should be an integer");
+			LogRecord record = parseLogRecord(body);
+
+			logger.log(record);
+			ingestedRecords.add();
+
+			res.status = 201;
+			res.set_content(
+				json {
+					{ "success", "true" }
+				}.dump(),
+				"application/json"
+			);
+		} catch (const HttpError& e) {
+			ingestErrors.add();
+			res.status = e.status();
+			res.set_content(
+				json {
+					{ "success", "false" },
+					{ "error", e.what() }
+				}.dump(),
+				"application/json"
+			);
+		} catch (const std::exception& e) {
+			ingestErrors.add();
+			res.status = 500;
+			res.set_content(
+				json{{"error", "Internal server error"}}.dump(),
+				"application/json"
+			);
+		}
+	});
+
+	// Accepts a JSON array or newline-delimited JSON. Valid entries are handed to
+	// the sinks as one batch; invalid ones are reported by their index.
+	server.Post("/log/batch", [&logger, &ingestedRecords, &ingestErrors, &ingestLatency](const httplib::Request& req, httplib::Response& res) {
+		ScopedTimer timer(ingestLatency);
+		try {
+			std::string contentType = req.get_header_value("Content-Type");
+			bool ndjson = contentType == "application/x-ndjson";
+			if (!ndjson && contentType != "application/json") {
+				throw HttpError(415, "Expected application/json or application/x-ndjson");
 			}
 
-			LogRecord record;
-			record.timestamp = body["timestamp"].get<int64_t>();
-			record.service = body["service"];
-			record.message = body["message"];
-			std::string level = body["level"];
-			std::transform(level.begin(), level.end(), level.begin(), [](unsigned char c) {
-				return std::tolower(c);
-			});
-			
-			if (level == "info") {
-				record.level = LogLevel::Info;
-			} else if (level == "debug") {
-				record.level = LogLevel::Debug;
-			} else if (level == "warn") {
-				record.level = LogLevel::Warn;
-			} else if (level == "error") {
-				record.level = LogLevel::Error;
-			} else if (level == "fatal") {
-				record.level = LogLevel::Fatal;
+			std::vector<LogRecord> records;
+			json errors = json::array();
+			size_t index = 0;
+
+			auto accept = [&](const json& entry) {
+				try {
+					records.push_back(parseLogRecord(entry));
+				} catch (const HttpError& e) {
+					errors.push_back({{"index", index}, {"error", e.what()}});
+				}
+				++index;
+			};
+
+			if (ndjson) {
+				std::string_view body(req.body);
+				size_t pos = 0;
+				while (pos < body.size()) {
+					size_t end = std::min(body.find('\n', pos), body.size());
+					std::string_view line = body.substr(pos, end - pos);
+					pos = end + 1;
+
+					if (line.find_first_not_of(" \t\r") == std::string_view::npos) {
+						continue;
+					}
+					if (index >= kMaxBatchRecords) {
+						throw HttpError(413, "Batch exceeds " + std::to_string(kMaxBatchRecords) + " records");
+					}
+
+					json entry = json::parse(line, nullptr, false);
+					if (entry.is_discarded()) {
+						errors.push_back({{"index", index++}, {"error", "Invalid JSON"}});
+						continue;
+					}
+					accept(entry);
+				}
 			} else {
-				throw HttpError(400, "Invalid level");
+				json body = json::parse(req.body, nullptr, false);
+				if (body.is_discarded() || !body.is_array()) {
+					throw HttpError(400, "Expected a JSON array of log entries");
+				}
+				if (body.size() > kMaxBatchRecords) {
+					throw HttpError(413, "Batch exceeds " + std::to_string(kMaxBatchRecords) + " records");
+				}
+				for (const auto& entry : body) {
+					accept(entry);
+				}
 			}
 
-			logger.log(record);
+			if (records.empty() && !errors.empty()) {
+				res.status = 400;
+				ingestErrors.add();
+			} else {
+				logger.logBatch(records);
+				ingestedRecords.add(records.size());
+				res.status = errors.empty() ? 201 : 207;
+			}
 
-			res.status = 201;
 			res.set_content(
 				json {
-					{ "success", "true" }
+					{ "success", errors.empty() ? "true" : "false" },
+					{ "accepted", records.size() },
+					{ "rejected", errors.size() },
+					{ "errors", errors }
 				}.dump(),
 				"application/json"
 			);
 		} catch (const HttpError& e) {
+			ingestErrors.add();
 			res.status = e.status();
 			res.set_content(
 				json {
@@ -181,6 +773,7 @@ int main() {
 				"application/json"
 			);
 		} catch (const std::exception& e) {
+			ingestErrors.add();
 			res.status = 500;
 			res.set_content(
 				json{{"error", "Internal server error"}}.dump(),
@@ -189,6 +782,20 @@ int main() {
 		}
 	});
 
+	// Optional firehose for producers that would rather not pay for HTTP and
+	// JSON per record: newline-delimited lines over TCP and UDP
+	std::unique_ptr<RawListener> rawListener;
+	RawListenerOptions rawOptions;
+	rawOptions.tcpPort = static_cast<int>(envSize("LOGAN_RAW_TCP_PORT", 0, 65535));
+	rawOptions.udpPort = static_cast<int>(envSize("LOGAN_RAW_UDP_PORT", 0, 65535));
+	rawOptions.maxConnections = static_cast<size_t>(envSize("LOGAN_RAW_MAX_CONNECTIONS", rawOptions.maxConnections));
+	if (rawOptions.tcpPort > 0 || rawOptions.udpPort > 0) {
+		rawListener = std::make_unique<RawListener>(logger, rawOptions);
+	}
+	registry.callback("logan_raw_ingest_connections", "Open raw ingest TCP connections", MetricType::Gauge, [&rawListener] {
+		return rawListener ? static_cast<double>(rawListener->connections()) : 0.0;
+	});
+
 	std::thread serverThread([&server]() {
 		std::cout << "Starting server on http://localhost:8080\n";
 		server.listen("0.0.0.0", 8080);
@@ -198,8 +805,10 @@ int main() {
 		std::this_thread::sleep_for(std::chrono::milliseconds(100));
 	}
 
+	tailSink->shutdown();                                    // Ends open tail streams so the server can stop
 	server.stop();
 	serverThread.join();
+	rawListener.reset();
 
 	return 0;
 }
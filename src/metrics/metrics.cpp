@@ -0,0 +1,134 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+size_t threadShard() {
+  static std::atomic<size_t> next{0};
+  thread_local size_t shard = next.fetch_add(1, std::memory_order_relaxed) % kMetricShards;
+  return shard;
+}
+
+void appendNumber(std::string& out, double value) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.9g", value);
+  out += text;
+}
+
+}
+
+void Counter::add(uint64_t n) {
+  shards_[threadShard()].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t Counter::value() const {
+  uint64_t total = 0;
+  for (const auto& shard : shards_) {
+    total += shard.value.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void Histogram::observe(std::chrono::steady_clock::duration elapsed) {
+  uint64_t nanos = static_cast<uint64_t>(std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), 0));
+  uint64_t micros = nanos / 1000;
+  size_t bucket = micros == 0 ? 0 : std::min<size_t>(64 - __builtin_clzll(micros), kBuckets - 1);
+
+  auto& shard = shards_[threadShard()];
+  shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+  shard.sumNanos.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+Histogram::Totals Histogram::totals() const {
+  Totals totals;
+  uint64_t sumNanos = 0;
+  for (const auto& shard : shards_) {
+    for (size_t i = 0; i < kBuckets; ++i) {
+      totals.counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+    }
+    sumNanos += shard.sumNanos.load(std::memory_order_relaxed);
+  }
+  for (uint64_t count : totals.counts) {
+    totals.count += count;
+  }
+  totals.sum = sumNanos / 1e9;
+  return totals;
+}
+
+double Histogram::upperBound(size_t bucket) {
+  return static_cast<double>(uint64_t{1} << bucket) / 1e6;
+}
+
+MetricsRegistry& MetricsRegistry::global() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+MetricsRegistry::Series& MetricsRegistry::series(const std::string& name, const std::string& help, const char* type, const std::string& labels) {
+  auto& family = families_[name];
+  family.help = help;
+  family.type = type;
+  return family.series[labels];
+}
+
+Counter& MetricsRegistry::counter(const std::string& name, const std::string& help, const std::string& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& entry = series(name, help, "counter", labels);
+  if (!entry.counter) {
+    entry.counter = std::make_unique<Counter>();
+  }
+  return *entry.counter;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string& name, const std::string& help, const std::string& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& entry = series(name, help, "histogram", labels);
+  if (!entry.histogram) {
+    entry.histogram = std::make_unique<Histogram>();
+  }
+  return *entry.histogram;
+}
+
+void MetricsRegistry::callback(const std::string& name, const std::string& help, MetricType type, std::function<double()> read, const std::string& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  series(name, help, type == MetricType::Counter ? "counter" : "gauge", labels).read = std::move(read);
+}
+
+std::string MetricsRegistry::render() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string out;
+
+  for (const auto& [name, family] : families_) {
+    out += "# HELP " + name + " " + family.help + "\n";
+    out += "# TYPE " + name + " " + family.type + "\n";
+
+    for (const auto& [labels, entry] : family.series) {
+      std::string braced = labels.empty() ? "" : "{" + labels + "}";
+      if (entry.counter) {
+        out += name + braced + " " + std::to_string(entry.counter->value()) + "\n";
+      } else if (entry.histogram) {
+        auto totals = entry.histogram->totals();
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < Histogram::kBuckets; ++i) {
+          cumulative += totals.counts[i];
+          out += name + "_bucket{" + (labels.empty() ? "" : labels + ",") + "le=\"";
+          if (i + 1 == Histogram::kBuckets) {
+            out += "+Inf";
+          } else {
+            appendNumber(out, Histogram::upperBound(i));
+          }
+          out += "\"} " + std::to_string(cumulative) + "\n";
+        }
+        out += name + "_sum" + braced + " ";
+        appendNumber(out, totals.sum);
+        out += "\n" + name + "_count" + braced + " " + std::to_string(totals.count) + "\n";
+      } else if (entry.read) {
+        out += name + braced + " ";
+        appendNumber(out, entry.read());
+        out += "\n";
+      }
+    }
+  }
+  return out;
+}
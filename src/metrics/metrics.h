@@ -0,0 +1,115 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Counters and histograms cheap enough for the ingest and scan paths. Each
+// is split into cache-line-sized shards, one picked per thread, so updates
+// from different threads neither lock nor share a line; a scrape sums them.
+constexpr size_t kMetricShards = 16;
+
+class Counter {
+public:
+  void add(uint64_t n = 1);
+  uint64_t value() const;
+
+private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value{0};
+  };
+  std::array<Shard, kMetricShards> shards_;
+};
+
+// Durations in power-of-two buckets: under 1us, 2us, 4us, ... 2^26us (~67s),
+// and one for anything longer
+class Histogram {
+public:
+  static constexpr size_t kBuckets = 28;
+
+  struct Totals {
+    std::array<uint64_t, kBuckets> counts{};
+    uint64_t count = 0;
+    double sum = 0;                                         // Seconds
+  };
+
+  void observe(std::chrono::steady_clock::duration elapsed);
+  Totals totals() const;
+
+  // Upper bound of a bucket in seconds; the last one is unbounded
+  static double upperBound(size_t bucket);
+
+private:
+  struct alignas(64) Shard {
+    std::array<std::atomic<uint64_t>, kBuckets> counts{};
+    std::atomic<uint64_t> sumNanos{0};
+  };
+  std::array<Shard, kMetricShards> shards_;
+};
+
+// Observes the time from construction to destruction
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Histogram& histogram)
+    : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    histogram_.observe(std::chrono::steady_clock::now() - start_);
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+  Histogram& histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+enum class MetricType {
+  Counter,
+  Gauge
+};
+
+// Process-wide set of named metrics. Registering takes a lock, so modules
+// look their metrics up once and keep the reference. `labels`, if given, is
+// a Prometheus label list such as `sink="console"` that tells apart series
+// of the same name.
+class MetricsRegistry {
+public:
+  static MetricsRegistry& global();
+
+  // The same name and labels always return the same metric
+  Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+  Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+  // A value read at scrape time, e.g. a queue depth. Replaces an earlier
+  // callback of the same name and labels.
+  void callback(const std::string& name, const std::string& help, MetricType type, std::function<double()> read, const std::string& labels = "");
+
+  // Prometheus text exposition format (version 0.0.4)
+  std::string render() const;
+
+private:
+  struct Series {
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Histogram> histogram;
+    std::function<double()> read;
+  };
+
+  struct Family {
+    std::string help;
+    const char* type = "counter";
+    std::map<std::string, Series> series;                   // By label list
+  };
+
+  Series& series(const std::string& name, const std::string& help, const char* type, const std::string& labels);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_;                  // Sorted, so scrapes list metrics in a stable order
+};
@@ -0,0 +1,128 @@
+#include "aggregator.h"
+#include "../../include/errors/http_error.h"
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <tuple>
+
+namespace {
+
+using StatsKey = std::tuple<int64_t, ServiceId, int>;
+
+// Distance from the start of the `step`-aligned interval `value` is in
+int64_t offsetIn(int64_t value, int64_t step) {
+  int64_t offset = value % step;
+  return offset < 0 ? offset + step : offset;
+}
+
+// A bucket starting below the int64 range is reported as starting at its minimum
+int64_t floorTo(int64_t value, int64_t step) {
+  int64_t start;
+  if (__builtin_sub_overflow(value, offsetIn(value, step), &start)) {
+    return std::numeric_limits<int64_t>::min();
+  }
+  return start;
+}
+
+}
+
+Aggregator::Aggregator(const std::shared_ptr<const RollupStore>& rollups, Querier& querier)
+  : rollups_(rollups), querier_(querier) {}
+
+std::vector<StatsRow> Aggregator::aggregate(const StatsParams& params) const {
+  const QueryParams& filter = params.filter;
+  int64_t resolution = rollups_->resolution();
+
+  if (params.bucket && (params.bucket.value() <= 0 || params.bucket.value() % resolution != 0)) {
+    throw HttpError(400, "Bucket should be a multiple of " + std::to_string(resolution) + "s");
+  }
+
+  std::map<StatsKey, uint64_t> counts;
+  auto count = [&](int64_t timestamp, ServiceId service, LogLevel level, uint64_t n) {
+    StatsKey key{
+      params.bucket ? floorTo(timestamp, params.bucket.value()) : 0,
+      params.byService ? service : kNoServiceId,
+      params.byLevel ? static_cast<int>(level) : -1
+    };
+    counts[key] += n;
+  };
+
+  auto scan = [&](std::optional<int64_t> from, std::optional<int64_t> to) {
+    QueryParams range = filter;
+    range.from = from;
+    range.to = to;
+    range.limit.reset();
+    range.cursor.reset();
+    querier_.scan(range, [&](const LogRecordView& log) {
+      count(log.timestamp, params.byService ? ServiceTable::global().intern(log.service) : kNoServiceId, log.level, 1);
+      return true;
+    });
+  };
+
+  if (filter.contains || filter.regex) {
+    scan(filter.from, filter.to);                           // Rollups don't know about message contents
+  } else {
+    // Whole cells inside [from, to] come from the rollups, partial ones at
+    // either end are counted from the records themselves
+    constexpr int64_t kMin = std::numeric_limits<int64_t>::min();
+    constexpr int64_t kMax = std::numeric_limits<int64_t>::max();
+    int64_t from = filter.from.value_or(kMin);
+    int64_t to = filter.to.value_or(kMax);
+
+    int64_t fromOffset = offsetIn(from, resolution);
+    int64_t toOffset = offsetIn(to, resolution);
+
+    // A range whose first whole cell would start past the int64 range, or
+    // whose last cell starts before it, is counted by scanning instead
+    int64_t cellsFrom = from;
+    int64_t cellsTo = kMax;
+    bool fits = (from == kMin || fromOffset == 0 || !__builtin_add_overflow(from, resolution - fromOffset, &cellsFrom)) &&
+                (to == kMax || !__builtin_sub_overflow(to, toOffset, &cellsTo));
+    if (to != kMax && toOffset == resolution - 1) {
+      cellsTo = to + 1;                                     // `to` closes its cell
+    }
+
+    if (fits && cellsFrom < cellsTo) {
+      std::optional<ServiceId> service;
+      if (filter.service) {
+        service = ServiceTable::global().find(filter.service.value());
+      }
+      if (!filter.service || service) {
+        rollups_->visit(cellsFrom, cellsTo, service, filter.level, count);
+      }
+      if (from < cellsFrom) {
+        scan(from, cellsFrom - 1);
+      }
+      if (to != kMax && cellsTo <= to) {
+        scan(cellsTo, to);
+      }
+    } else {
+      scan(filter.from, filter.to);                         // No whole cell in the range that int64 can express
+    }
+  }
+
+  std::vector<StatsRow> rows;
+  rows.reserve(counts.size());
+  for (const auto& [key, n] : counts) {
+    StatsRow row;
+    if (params.bucket) {
+      row.bucket = std::get<0>(key);
+    }
+    if (params.byService) {
+      row.service = std::string(ServiceTable::global().name(std::get<1>(key)));
+    }
+    if (params.byLevel) {
+      row.level = static_cast<LogLevel>(std::get<2>(key));
+    }
+    row.count = n;
+    rows.push_back(std::move(row));
+  }
+
+  // Keys are ordered by service id; present services by name
+  if (params.byService) {
+    std::stable_sort(rows.begin(), rows.end(), [](const StatsRow& a, const StatsRow& b) {
+      return std::tie(a.bucket, a.service) < std::tie(b.bucket, b.service);
+    });
+  }
+  return rows;
+}
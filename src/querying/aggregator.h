@@ -0,0 +1,40 @@
+#pragma once
+
+#include "query_params.h"
+#include "querier.h"
+#include "rollup_store.h"
+#include "../logging/log_level.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct StatsParams {
+  QueryParams filter;                                       // `limit` and `cursor` are ignored
+  bool byService = false;
+  bool byLevel = false;
+  std::optional<int64_t> bucket;                            // Seconds; a single bucket over the whole range if unset
+};
+
+struct StatsRow {
+  std::optional<int64_t> bucket;                            // Bucket start
+  std::optional<std::string> service;
+  std::optional<LogLevel> level;
+  uint64_t count = 0;
+};
+
+// Answers counting queries from the rollups, reading segments only for the
+// parts the rollups cannot: range edges that cut through a rollup cell, and
+// message filters.
+class Aggregator {
+public:
+  Aggregator(const std::shared_ptr<const RollupStore>& rollups, Querier& querier);
+
+  // Rows ordered by bucket, service, level
+  std::vector<StatsRow> aggregate(const StatsParams& params) const;
+
+private:
+  std::shared_ptr<const RollupStore> rollups_;
+  Querier& querier_;
+};
@@ -1,21 +1,374 @@
 #include "querier.h"
 #include "../source/source.h"
 #include "../logging/log_record.h"
+#include "../../include/errors/http_error.h"
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
 #include <memory>
 #include <vector>
 
+namespace {
+
+constexpr int64_t kBoundaryStep = 60;                       // Seconds the cold part's end is rounded up to
+
+bool inOrder(SortOrder order, int64_t a, int64_t b) {
+  return order == SortOrder::Asc ? a < b : a > b;
+}
+
+// The end of the range the other sources answer when memory starts at
+// `boundary`. It is rounded up to a whole step, so their params, and with
+// them the result cache keys, stay put while the boundary moves within it;
+// the few records past the boundary are dropped by the visitor.
+int64_t coldTo(const QueryParams& params, int64_t boundary) {
+  int64_t end = boundary;
+  if (boundary <= std::numeric_limits<int64_t>::max() - kBoundaryStep) {
+    int64_t past = boundary % kBoundaryStep;
+    end = past == 0 ? boundary : boundary - past + (past > 0 ? kBoundaryStep : 0);
+  }
+  return std::min(params.to.value_or(end - 1), end - 1);
+}
+
+// What one source contributes to an ordered query. With a limit only the
+// first `limit` records in order are kept, in a heap topped by the last of
+// them, which is published as the query's cutoff once the heap is full.
+class OrderedMatches {
+public:
+  OrderedMatches(SortOrder order, std::optional<size_t> limit, std::shared_ptr<ScanCutoff> cutoff)
+    : order_(order), limit_(limit), cutoff_(std::move(cutoff)) {}
+
+  void add(const LogRecordView& record) {
+    if (!limit_) {
+      records_.push_back(toRecord(record));
+      return;
+    }
+    if (cutoff_->excludes(record.timestamp, record.timestamp)) {
+      return;
+    }
+
+    auto later = [this](const LogRecord& a, const LogRecord& b) {
+      return inOrder(order_, a.timestamp, b.timestamp);
+    };
+    if (records_.size() < limit_.value()) {
+      records_.push_back(toRecord(record));
+      std::push_heap(records_.begin(), records_.end(), later);
+    } else if (inOrder(order_, record.timestamp, records_.front().timestamp)) {
+      std::pop_heap(records_.begin(), records_.end(), later);
+      LogRecord& slot = records_.back();                    // Reuses the evicted record's buffers
+      slot.timestamp = record.timestamp;
+      slot.service.assign(record.service);
+      slot.level = record.level;
+      slot.message.assign(record.message);
+      std::push_heap(records_.begin(), records_.end(), later);
+    } else {
+      return;
+    }
+
+    if (records_.size() == limit_.value()) {
+      cutoff_->tighten(records_.front().timestamp);
+    }
+  }
+
+  // The kept records, sorted in order
+  std::vector<LogRecord> take() {
+    std::stable_sort(records_.begin(), records_.end(), [this](const LogRecord& a, const LogRecord& b) {
+      return inOrder(order_, a.timestamp, b.timestamp);
+    });
+    return std::move(records_);
+  }
+
+private:
+  SortOrder order_;
+  std::optional<size_t> limit_;
+  std::shared_ptr<ScanCutoff> cutoff_;
+  std::vector<LogRecord> records_;
+};
+
+}
+
 Querier::Querier(const std::shared_ptr<Source>& source)
   : sources_{source} {}
 
+Querier::~Querier() = default;
+
 void Querier::addSource(const std::shared_ptr<Source>& source) {
   sources_.push_back(source);
+  if (!pool_) {
+    pool_ = std::make_unique<ThreadPool>(0);
+  }
+}
+
+void Querier::setHotTier(const std::shared_ptr<MemorySource>& hot) {
+  hot_ = hot;
+  if (!pool_) {
+    pool_ = std::make_unique<ThreadPool>(0);
+  }
+}
+
+std::optional<QueryCursor> Querier::scan(const QueryParams& params, const RecordVisitor& visit) {
+  if (params.order) {
+    scanOrdered(params, visit);
+    return std::nullopt;
+  }
+  if (!hot_) {
+    return scanSources(params, visit);
+  }
+
+  // Timestamps before the boundary come from the other sources, the rest from
+  // memory. A cursor keeps the boundary of the first page so pages neither
+  // overlap nor leave gaps as the window moves.
+  auto snapshot = hot_->snapshot();
+  checkCursor(params, snapshot.coveredFrom);
+  int64_t boundary = params.cursor && params.cursor->boundary ? params.cursor->boundary.value() : snapshot.coveredFrom;
+  std::optional<int64_t> coldFrom = params.cursor ? params.cursor->coldFrom : std::nullopt;
+  size_t hotIndex = sources_.size();                        // The hot tier's cursor source index
+  size_t remaining = params.limit.value_or(0);
+  auto counted = [&](const LogRecordView& record) {
+    if (!visit(record)) {
+      return false;
+    }
+    return !params.limit || --remaining > 0;
+  };
+
+  bool resumingHot = params.cursor && params.cursor->source == hotIndex;
+  std::optional<QueryCursor> cursor = resumingHot ? std::nullopt : params.cursor;
+  while (!resumingHot) {
+    // With nothing ever evicted, memory holds every record
+    bool coldPart = boundary != std::numeric_limits<int64_t>::min() &&
+      (!params.from || params.from.value() < boundary) &&
+      (!coldFrom || !params.to || params.to.value() >= coldFrom.value());
+    if (coldPart) {
+      QueryParams cold = params;
+      cold.limit.reset();
+      cold.cursor = cursor;
+      cold.to = coldTo(params, boundary);
+      if (coldFrom) {
+        cold.from = std::max(params.from.value_or(coldFrom.value()), coldFrom.value());
+      }
+
+      auto resume = scanSources(cold, [&](const LogRecordView& record) {
+        return record.timestamp >= boundary || counted(record);
+      });
+      if (resume) {
+        resume->boundary = boundary;
+        resume->coldFrom = coldFrom;
+        return resume;
+      }
+    }
+
+    // Memory evicted past the boundary since the first page, so what it no
+    // longer holds is read from disk before moving on to it
+    if (snapshot.coveredFrom <= boundary) {
+      break;
+    }
+    if (boundary != std::numeric_limits<int64_t>::min()) {
+      coldFrom = boundary;
+    }
+    boundary = snapshot.coveredFrom;
+    cursor.reset();
+  }
+
+  if (params.to && params.to.value() < boundary) {
+    return std::nullopt;
+  }
+
+  QueryParams hot = params;
+  hot.from = std::max(params.from.value_or(boundary), boundary);
+  if (!resumingHot) {
+    hot.cursor.reset();
+  }
+
+  auto resume = hot_->scan(snapshot, hot, counted);
+  if (resume) {
+    resume->source = hotIndex;
+    resume->boundary = boundary;
+  }
+  return resume;
+}
+
+void Querier::checkCursor(const QueryParams& params) {
+  if (!params.cursor || params.order) {
+    return;
+  }
+  if (params.cursor->source < sources_.size()) {
+    sources_[params.cursor->source]->checkCursor(params.cursor.value());
+  } else if (hot_) {
+    checkCursor(params, hot_->coveredFrom());
+  }
+}
+
+// A cursor into memory is an ordinal, which says nothing about which of the
+// evicted records it had passed, so those can't be read from disk instead
+void Querier::checkCursor(const QueryParams& params, int64_t coveredFrom) const {
+  const auto& cursor = params.cursor;
+  if (!cursor || cursor->source != sources_.size() || !cursor->boundary || cursor->boundary.value() >= coveredFrom) {
+    return;
+  }
+  bool evicted = (!params.from || params.from.value() < coveredFrom) && (!params.to || params.to.value() >= cursor->boundary.value());
+  if (evicted) {
+    throw HttpError(410, "Records this cursor had yet to return were evicted from memory; restart the query");
+  }
+}
+
+std::optional<QueryCursor> Querier::scanSources(const QueryParams& params, const RecordVisitor& visit) {
+  size_t first = params.cursor ? params.cursor->source : 0;
+  size_t remaining = params.limit.value_or(0);
+
+  for (size_t i = first; i < sources_.size(); ++i) {
+    QueryParams sourceParams = params;
+    if (i != first) {
+      sourceParams.cursor.reset();                          // Only the first source resumes mid-way
+    }
+
+    auto resume = sources_[i]->scan(sourceParams, [&](const LogRecordView& record) {
+      if (!visit(record)) {
+        return false;
+      }
+      return !params.limit || --remaining > 0;
+    });
+
+    if (resume) {
+      resume->source = i;
+      return resume;
+    }
+  }
+  return std::nullopt;
+}
+
+void Querier::scanOrdered(const QueryParams& params, const RecordVisitor& visit) {
+  SortOrder order = params.order.value();
+  if (params.limit && params.limit.value() == 0) {
+    return;
+  }
+
+  QueryParams base = params;
+  base.cursor.reset();
+  std::shared_ptr<ScanCutoff> cutoff;
+  if (params.limit) {
+    cutoff = std::make_shared<ScanCutoff>(order);           // Shared, so every source skips by the tightest one
+    base.cutoff = cutoff;
+  }
+
+  // One part per source. With a hot tier, the other sources answer the range
+  // before its boundary and memory answers the rest.
+  std::vector<std::function<void(OrderedMatches&)>> parts;
+  std::optional<MemorySource::Snapshot> snapshot;
+  int64_t boundary = std::numeric_limits<int64_t>::min();
+  if (hot_) {
+    snapshot = hot_->snapshot();
+    boundary = snapshot->coveredFrom;
+  }
+
+  bool coldPart = !hot_ || (boundary != std::numeric_limits<int64_t>::min() && (!params.from || params.from.value() < boundary));
+  if (coldPart) {
+    // A limited scan skips blocks, so it bypasses the result cache anyway and
+    // can take the exact boundary in its range
+    QueryParams cold = base;
+    if (hot_) {
+      cold.to = cutoff ? std::min(params.to.value_or(boundary - 1), boundary - 1) : coldTo(params, boundary);
+    }
+    for (const auto& source : sources_) {
+      parts.push_back([source, cold, boundary, hot = hot_ != nullptr](OrderedMatches& matches) {
+        source->scan(cold, [&](const LogRecordView& record) {
+          if (!hot || record.timestamp < boundary) {
+            matches.add(record);
+          }
+          return true;
+        });
+      });
+    }
+  }
+
+  if (hot_ && (!params.to || params.to.value() >= boundary)) {
+    QueryParams hot = base;
+    hot.from = std::max(params.from.value_or(boundary), boundary);
+    parts.push_back([this, &snapshot, hot](OrderedMatches& matches) {
+      hot_->scan(*snapshot, hot, [&](const LogRecordView& record) {
+        matches.add(record);
+        return true;
+      });
+    });
+  }
+
+  // The first part runs here, the rest on the pool. Every part is waited on
+  // before anything is rethrown, since they all borrow `matches`.
+  std::vector<OrderedMatches> matches(parts.size(), OrderedMatches(order, params.limit, cutoff));
+  std::vector<std::future<void>> pending;
+  for (size_t i = 1; i < parts.size(); ++i) {
+    pending.push_back(pool_->submit([&parts, &matches, i] {
+      parts[i](matches[i]);
+    }));
+  }
+
+  std::exception_ptr failure;
+  try {
+    if (!parts.empty()) {
+      parts[0](matches[0]);
+    }
+  } catch (...) {
+    failure = std::current_exception();
+  }
+  for (auto& part : pending) {
+    try {
+      part.get();
+    } catch (...) {
+      if (!failure) {
+        failure = std::current_exception();
+      }
+    }
+  }
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+
+  // k-way merge of the sorted runs; equal timestamps go in part order
+  std::vector<std::vector<LogRecord>> runs;
+  for (auto& part : matches) {
+    runs.push_back(part.take());
+  }
+
+  struct Head {
+    size_t run;
+    size_t index;
+  };
+  auto after = [&](const Head& a, const Head& b) {
+    int64_t left = runs[a.run][a.index].timestamp;
+    int64_t right = runs[b.run][b.index].timestamp;
+    return left != right ? inOrder(order, right, left) : a.run > b.run;
+  };
+
+  std::vector<Head> heads;
+  for (size_t i = 0; i < runs.size(); ++i) {
+    if (!runs[i].empty()) {
+      heads.push_back({i, 0});
+    }
+  }
+  std::make_heap(heads.begin(), heads.end(), after);
+
+  size_t remaining = params.limit.value_or(std::numeric_limits<size_t>::max());
+  while (!heads.empty() && remaining-- > 0) {
+    std::pop_heap(heads.begin(), heads.end(), after);
+    Head head = heads.back();
+    heads.pop_back();
+
+    const LogRecord& record = runs[head.run][head.index];
+    if (!visit(LogRecordView{record.timestamp, record.service, record.level, record.message})) {
+      return;
+    }
+    if (++head.index < runs[head.run].size()) {
+      heads.push_back(head);
+      std::push_heap(heads.begin(), heads.end(), after);
+    }
+  }
 }
 
 std::vector<LogRecord> Querier::query(const QueryParams& params) {
   std::vector<LogRecord> result;
-  for (const auto& source : sources_) {
-    auto partial = source->query(params);
-    result.insert(result.end(), std::make_move_iterator(partial.begin()), std::make_move_iterator(partial.end()));
-  }
+  scan(params, [&result](const LogRecordView& record) {
+    result.push_back(toRecord(record));
+    return true;
+  });
   return result;
 }
@@ -2,16 +2,49 @@
 
 #include <vector>
 #include <memory>
+#include <optional>
 #include "query_params.h"
 #include "../source/source.h"
+#include "../source/memory_source.h"
+#include "../concurrency/thread_pool.h"
 
 class Querier {
 public:
   Querier(const std::shared_ptr<Source>& source);
+  ~Querier();
+
+  // Sources are set up before the first query
   void addSource(const std::shared_ptr<Source>& source);
 
+  // Records with timestamps the hot tier covers are read from it instead of
+  // the other sources, which only see the part of the range before it
+  void setHotTier(const std::shared_ptr<MemorySource>& hot);
+
+  // Visits sources in order, stopping after `params.limit` records. Returns
+  // the cursor for the next page if the scan stopped early.
+  //
+  // With `params.order`, all sources are scanned at once and their matches
+  // merged by timestamp instead. Each keeps only the first `params.limit`
+  // records in that order and skips blocks that cannot beat them. Ordered
+  // queries don't page, so they take and return no cursor. Without a limit
+  // every match is held in memory, so callers serving clients require one.
+  std::optional<QueryCursor> scan(const QueryParams& params, const RecordVisitor& visit);
+
+  // Throws HttpError(410) if the cursor's source can no longer resume from
+  // it: the segment it points into was compacted without a usable map, or
+  // the hot tier evicted records it had not returned yet. scan() checks too,
+  // but by then the response may be under way, so callers streaming it
+  // check first.
+  void checkCursor(const QueryParams& params);
+
   std::vector<LogRecord> query(const QueryParams& params);
 
 private:
+  std::optional<QueryCursor> scanSources(const QueryParams& params, const RecordVisitor& visit);
+  void scanOrdered(const QueryParams& params, const RecordVisitor& visit);
+  void checkCursor(const QueryParams& params, int64_t coveredFrom) const;
+
   std::vector<std::shared_ptr<Source>> sources_;
+  std::shared_ptr<MemorySource> hot_;
+  std::unique_ptr<ThreadPool> pool_;                        // Runs all but one source of an ordered query; null with a single source
 };
@@ -1,12 +1,111 @@
 #pragma once
 
 #include "../logging/log_level.h"
-#include <string>
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <string>
+
+// Resume point of a paginated query, handed to clients as an opaque string
+struct QueryCursor {
+  QueryCursor() = default;
+  QueryCursor(size_t source, uint64_t segment, uint64_t offset)
+    : source(source), segment(segment), offset(offset) {}
+
+  size_t source = 0;                                        // Index of the source within the Querier
+  uint64_t segment = 0;
+  uint64_t offset = 0;
+  std::optional<uint64_t> firstSegment;                     // Set when `segment` is a compacted one, so offsets into its inputs are told apart
+  std::optional<int64_t> boundary;                          // Hot tier split the first page used, kept for later pages
+  std::optional<int64_t> coldFrom;                          // Set while disk fills in what memory evicted past an older boundary; earlier timestamps were already returned
+
+  std::string encode() const {
+    char text[128];
+    int length = firstSegment
+      ? std::snprintf(text, sizeof(text), "%zx-%" PRIx64 ".%" PRIx64 "-%" PRIx64, source, segment, firstSegment.value(), offset)
+      : std::snprintf(text, sizeof(text), "%zx-%" PRIx64 "-%" PRIx64, source, segment, offset);
+    if (boundary) {
+      length += std::snprintf(text + length, sizeof(text) - length, "-%" PRIx64, static_cast<uint64_t>(boundary.value()));
+      if (coldFrom) {
+        std::snprintf(text + length, sizeof(text) - length, "-%" PRIx64, static_cast<uint64_t>(coldFrom.value()));
+      }
+    }
+    return text;
+  }
+
+  static std::optional<QueryCursor> decode(const std::string& text) {
+    QueryCursor cursor;
+    uint64_t first = 0;
+    uint64_t boundary = 0;
+    uint64_t coldFrom = 0;
+    int consumed = 0;
+    int fields = std::sscanf(text.c_str(), "%zx-%" SCNx64 ".%" SCNx64 "-%" SCNx64 "%n-%" SCNx64 "%n-%" SCNx64 "%n", &cursor.source, &cursor.segment, &first, &cursor.offset, &consumed, &boundary, &consumed, &coldFrom, &consumed);
+    if (fields >= 4) {
+      cursor.firstSegment = first;
+      fields--;
+    } else {
+      consumed = 0;
+      fields = std::sscanf(text.c_str(), "%zx-%" SCNx64 "-%" SCNx64 "%n-%" SCNx64 "%n-%" SCNx64 "%n", &cursor.source, &cursor.segment, &cursor.offset, &consumed, &boundary, &consumed, &coldFrom, &consumed);
+    }
+    if (fields < 3 || static_cast<size_t>(consumed) != text.size()) {
+      return std::nullopt;
+    }
+    if (fields >= 4) {
+      cursor.boundary = static_cast<int64_t>(boundary);
+    }
+    if (fields == 5) {
+      cursor.coldFrom = static_cast<int64_t>(coldFrom);
+    }
+    return cursor;
+  }
+};
+
+enum class SortOrder {
+  Asc,
+  Desc
+};
+
+// Published by an ordered query with a limit once some source has produced
+// `limit` records: the timestamp of the last of them. Records ordered after
+// it cannot make the result, so sources may skip blocks that only hold those.
+class ScanCutoff {
+public:
+  explicit ScanCutoff(SortOrder order)
+    : order_(order),
+      timestamp_(order == SortOrder::Asc ? std::numeric_limits<int64_t>::max() : std::numeric_limits<int64_t>::min()) {}
+
+  // Only ever moves towards the start of the order
+  void tighten(int64_t timestamp) {
+    int64_t current = timestamp_.load(std::memory_order_relaxed);
+    while ((order_ == SortOrder::Asc ? timestamp < current : timestamp > current) &&
+           !timestamp_.compare_exchange_weak(current, timestamp, std::memory_order_relaxed)) {
+    }
+  }
+
+  // True if no timestamp in [minTimestamp, maxTimestamp] can make the result
+  bool excludes(int64_t minTimestamp, int64_t maxTimestamp) const {
+    int64_t cutoff = timestamp_.load(std::memory_order_relaxed);
+    return order_ == SortOrder::Asc ? minTimestamp > cutoff : maxTimestamp < cutoff;
+  }
+
+private:
+  SortOrder order_;
+  std::atomic<int64_t> timestamp_;
+};
 
 struct QueryParams {
   std::optional<LogLevel> level;
   std::optional<std::string> service;
   std::optional<int64_t> from;
   std::optional<int64_t> to;
+  std::optional<std::string> contains;                      // Message substring (`q`)
+  std::optional<std::string> regex;                         // Message regex (`re`)
+  std::optional<size_t> limit;
+  std::optional<QueryCursor> cursor;
+  std::optional<SortOrder> order;                           // By timestamp; storage order if unset
+  std::shared_ptr<const ScanCutoff> cutoff;                 // Set by the Querier for ordered queries with a limit
 };
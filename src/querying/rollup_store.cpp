@@ -0,0 +1,106 @@
+#include "rollup_store.h"
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <mutex>
+
+namespace {
+
+template <typename Cell>
+auto findService(Cell& cell, ServiceId service) {
+  return std::lower_bound(cell.begin(), cell.end(), service, [](const auto& entry, ServiceId id) {
+    return entry.first < id;
+  });
+}
+
+}
+
+RollupStore::RollupStore(int64_t resolution)
+  : resolution_(std::max<int64_t>(resolution, 1)) {}
+
+int64_t RollupStore::resolution() const {
+  return resolution_;
+}
+
+int64_t RollupStore::cellOf(int64_t timestamp) const {
+  int64_t cell = timestamp / resolution_;
+  if (timestamp % resolution_ < 0) {
+    --cell;                                                 // Floor, not truncate, for timestamps before the epoch
+  }
+  int64_t start;
+  if (__builtin_mul_overflow(cell, resolution_, &start)) {
+    return std::numeric_limits<int64_t>::min();             // The lowest cell starts below the int64 range
+  }
+  return start;
+}
+
+void RollupStore::add(const LogRecord* logs, size_t count) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  for (size_t i = 0; i < count; ++i) {
+    addLocked(logs[i].timestamp, serviceIdOf(logs[i]), logs[i].level);
+  }
+}
+
+void RollupStore::add(const LogRecordView& log) {
+  ServiceId service = ServiceTable::global().intern(log.service);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  addLocked(log.timestamp, service, log.level);
+}
+
+void RollupStore::remove(const LogRecordView& log) {
+  auto service = ServiceTable::global().find(log.service);
+  if (!service) {
+    return;
+  }
+
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto cell = cells_.find(cellOf(log.timestamp));
+  if (cell == cells_.end()) {
+    return;
+  }
+  auto entry = findService(cell->second, *service);
+  if (entry == cell->second.end() || entry->first != *service) {
+    return;
+  }
+  auto& count = entry->second[static_cast<size_t>(log.level)];
+  if (count == 0 || --count > 0) {
+    return;
+  }
+
+  // Expired services and cells go away entirely once their last count does
+  if (std::all_of(entry->second.begin(), entry->second.end(), [](uint64_t n) { return n == 0; })) {
+    cell->second.erase(entry);
+  }
+  if (cell->second.empty()) {
+    cells_.erase(cell);
+  }
+}
+
+void RollupStore::addLocked(int64_t timestamp, ServiceId service, LogLevel level) {
+  // Batches are mostly in one cell, so check the newest one before searching
+  int64_t start = cellOf(timestamp);
+  auto cell = !cells_.empty() && cells_.rbegin()->first == start ? std::prev(cells_.end()) : cells_.try_emplace(start).first;
+
+  auto entry = findService(cell->second, service);
+  if (entry == cell->second.end() || entry->first != service) {
+    entry = cell->second.emplace(entry, service, Counts{});
+  }
+  ++entry->second[static_cast<size_t>(level)];
+}
+
+void RollupStore::visit(int64_t from, int64_t to, const std::optional<ServiceId>& service, const std::optional<LogLevel>& level, const RollupVisitor& visit) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+
+  for (auto cell = cells_.lower_bound(from); cell != cells_.end() && cell->first < to; ++cell) {
+    auto entry = service ? findService(cell->second, service.value()) : cell->second.begin();
+    for (; entry != cell->second.end() && (!service || entry->first == service.value()); ++entry) {
+      const auto& [id, counts] = *entry;
+      for (size_t l = 0; l < kLogLevelCount; ++l) {
+        if (counts[l] == 0 || (level && static_cast<size_t>(level.value()) != l)) {
+          continue;
+        }
+        visit(cell->first, id, static_cast<LogLevel>(l), counts[l]);
+      }
+    }
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "../logging/log_level.h"
+#include "../logging/log_record.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+// Receives the record count of one (cell, service, level)
+using RollupVisitor = std::function<void(int64_t cell, ServiceId service, LogLevel level, uint64_t count)>;
+
+// Record counts per (time cell, service, level), kept up to date by the
+// FileSink as it writes batches so counting queries never read segments.
+// Cells are `resolution` seconds wide and aligned to the epoch.
+class RollupStore {
+public:
+  explicit RollupStore(int64_t resolution = 60);
+
+  int64_t resolution() const;
+
+  // Start of the cell `timestamp` falls in, or INT64_MIN for the lowest cell
+  // if it starts below the int64 range
+  int64_t cellOf(int64_t timestamp) const;
+
+  void add(const LogRecord* logs, size_t count);
+  void add(const LogRecordView& log);
+  void remove(const LogRecordView& log);                    // For records deleted by retention
+
+  // Visits the non-zero counts of the cells starting in [from, to)
+  void visit(int64_t from, int64_t to, const std::optional<ServiceId>& service, const std::optional<LogLevel>& level, const RollupVisitor& visit) const;
+
+private:
+  using Counts = std::array<uint64_t, kLogLevelCount>;
+  using Cell = std::vector<std::pair<ServiceId, Counts>>;  // Sorted by ServiceId; only services seen in the cell
+
+  void addLocked(int64_t timestamp, ServiceId service, LogLevel level);
+
+  int64_t resolution_;
+  mutable std::shared_mutex mutex_;
+  std::map<int64_t, Cell> cells_;                           // Cell start -> counts per service
+};
@@ -0,0 +1,108 @@
+#include "text_match.h"
+#include <cstring>
+
+#if defined(LOGAN_HAVE_RE2)
+#include <re2/re2.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+size_t findSubstring(std::string_view haystack, std::string_view needle) {
+  size_t n = needle.size();
+  if (n == 0) {
+    return 0;
+  }
+  if (n > haystack.size()) {
+    return std::string_view::npos;
+  }
+  if (n == 1) {
+    const void* hit = std::memchr(haystack.data(), needle[0], haystack.size());
+    return hit ? static_cast<const char*>(hit) - haystack.data() : std::string_view::npos;
+  }
+
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const char* data = haystack.data();
+  const __m128i first = _mm_set1_epi8(needle.front());
+  const __m128i last = _mm_set1_epi8(needle.back());
+
+  for (; i + n - 1 + 16 <= haystack.size(); i += 16) {
+    __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + n - 1));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast))));
+
+    while (mask) {
+      unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+      if (std::memcmp(data + i + bit + 1, needle.data() + 1, n - 2) == 0) {
+        return i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  size_t tail = haystack.substr(i).find(needle);
+  return tail == std::string_view::npos ? tail : i + tail;
+}
+
+namespace {
+
+constexpr size_t kMaxRegexBytes = 1024;
+
+#if defined(LOGAN_HAVE_RE2)
+RE2::Options regexOptions() {
+  RE2::Options options;
+  options.set_log_errors(false);
+  return options;
+}
+#endif
+
+}
+
+std::optional<std::string> regexError(const std::string& pattern) {
+#if defined(LOGAN_HAVE_RE2)
+  if (pattern.size() > kMaxRegexBytes) {
+    return "Regex is longer than " + std::to_string(kMaxRegexBytes) + " bytes";
+  }
+  RE2 regex(pattern, regexOptions());
+  if (!regex.ok()) {
+    return "Invalid regex: " + regex.error();
+  }
+  return std::nullopt;
+#else
+  (void)pattern;
+  return std::string("Regex search is not available in this build");
+#endif
+}
+
+TextMatcher::TextMatcher(const QueryParams& params)
+  : substring_(params.contains) {
+#if defined(LOGAN_HAVE_RE2)
+  if (params.regex) {
+    regex_ = std::make_shared<const RE2>(params.regex.value(), regexOptions());
+  }
+#endif
+}
+
+bool TextMatcher::active() const {
+  return substring_ || regex_;
+}
+
+const std::optional<std::string>& TextMatcher::substring() const {
+  return substring_;
+}
+
+bool TextMatcher::matches(std::string_view message) const {
+  if (substring_ && findSubstring(message, substring_.value()) == std::string_view::npos) {
+    return false;
+  }
+#if defined(LOGAN_HAVE_RE2)
+  if (regex_ && !RE2::PartialMatch(re2::StringPiece(message.data(), message.size()), *regex_)) {
+    return false;
+  }
+#endif
+  return true;
+}
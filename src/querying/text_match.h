@@ -0,0 +1,39 @@
+#pragma once
+
+#include "query_params.h"
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace re2 {
+class RE2;
+}
+
+// Position of `needle` in `haystack`, or npos. Compares 16 candidate
+// positions at a time on their first and last bytes with SSE2 and only
+// memcmps the survivors.
+size_t findSubstring(std::string_view haystack, std::string_view needle);
+
+// `re` patterns run on RE2, which matches in time linear in the message and
+// without recursion, since they come from clients and messages can be 64 KiB.
+// A build without RE2 refuses them. Returns why `pattern` can't be used, or
+// nullopt if it can.
+std::optional<std::string> regexError(const std::string& pattern);
+
+// The `q` (substring) and `re` (regex) message filters, compiled once per
+// query and safe to share between scan workers. `re` must have passed
+// regexError().
+class TextMatcher {
+public:
+  explicit TextMatcher(const QueryParams& params);
+
+  bool active() const;
+  const std::optional<std::string>& substring() const;
+  bool matches(std::string_view message) const;
+
+private:
+  std::optional<std::string> substring_;
+  std::shared_ptr<const re2::RE2> regex_;
+};
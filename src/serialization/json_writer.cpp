@@ -0,0 +1,85 @@
+#include "json_writer.h"
+#include <charconv>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+bool needsEscape(unsigned char c) {
+  return c < 0x20 || c == '"' || c == '\\';
+}
+
+// Position of the first byte at or after `pos` that needs escaping, or the end
+size_t findEscape(std::string_view text, size_t pos) {
+#if defined(__SSE2__)
+  const char* data = text.data();
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1f);
+
+  for (; pos + 16 <= text.size(); pos += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+    // Unsigned c <= 0x1f, as min(c, 0x1f) == c
+    __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(block, control), block);
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(controls, special)));
+    if (mask) {
+      return pos + static_cast<size_t>(__builtin_ctz(mask));
+    }
+  }
+#endif
+
+  while (pos < text.size() && !needsEscape(static_cast<unsigned char>(text[pos]))) {
+    ++pos;
+  }
+  return pos;
+}
+
+void appendEscape(std::string& out, unsigned char c) {
+  switch (c) {
+    case '"':  out += "\\\""; return;
+    case '\\': out += "\\\\"; return;
+    case '\b': out += "\\b"; return;
+    case '\f': out += "\\f"; return;
+    case '\n': out += "\\n"; return;
+    case '\r': out += "\\r"; return;
+    case '\t': out += "\\t"; return;
+  }
+  static const char kHex[] = "0123456789abcdef";
+  char escaped[] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xf]};
+  out.append(escaped, sizeof(escaped));
+}
+
+}
+
+void appendJsonString(std::string& out, std::string_view text) {
+  out += '"';
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t escape = findEscape(text, pos);
+    out.append(text.data() + pos, escape - pos);
+    if (escape == text.size()) {
+      break;
+    }
+    appendEscape(out, static_cast<unsigned char>(text[escape]));
+    pos = escape + 1;
+  }
+  out += '"';
+}
+
+void appendJsonRecord(std::string& out, const LogRecordView& record) {
+  out += "{\"level\":\"";
+  out += logLevelToString(record.level);                   // Never needs escaping
+  out += "\",\"message\":";
+  appendJsonString(out, record.message);
+  out += ",\"service\":";
+  appendJsonString(out, record.service);
+  out += ",\"timestamp\":";
+
+  char digits[24];
+  char* end = std::to_chars(digits, digits + sizeof(digits), record.timestamp).ptr;
+  out.append(digits, end);
+  out += '}';
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "../logging/log_record.h"
+#include <string>
+#include <string_view>
+
+// Appends `text` as a quoted JSON string. Runs without characters to escape
+// are copied in one piece; bytes >= 0x80 pass through unchanged.
+void appendJsonString(std::string& out, std::string_view text);
+
+// Appends a record as a JSON object, keys in the same (sorted) order the
+// nlohmann serializer used, so responses are byte-for-byte unchanged
+void appendJsonRecord(std::string& out, const LogRecordView& record);
@@ -0,0 +1,134 @@
+#include "async_sink.h"
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+namespace {
+
+std::string sinkLabels(const Sink& sink) {
+  return "sink=\"" + sink.name() + "\"";
+}
+
+}
+
+AsyncSink::AsyncSink(std::shared_ptr<Sink> sink, AsyncSinkOptions options)
+  : sink_(std::move(sink)),
+    options_(options),
+    labels_(sinkLabels(*sink_)),
+    queue_(options.queueCapacity),
+    offered_(0),
+    workerSleeping_(false),
+    running_(true),
+    dropped_(MetricsRegistry::global().counter("logan_async_sink_dropped_records_total", "Records an async sink dropped because its queue was full", labels_)),
+    errors_(MetricsRegistry::global().counter("logan_async_sink_errors_total", "Batches an async sink failed to write", labels_)),
+    writes_(MetricsRegistry::global().histogram("logan_async_sink_write_seconds", "Time an async sink took to write one batch", labels_)) {
+  options_.maxBatch = std::max<size_t>(options_.maxBatch, 1);
+  batch_.reserve(options_.maxBatch);
+
+  MetricsRegistry::global().callback("logan_async_sink_queue_depth", "Records queued ahead of an async sink", MetricType::Gauge, [this] {
+    return static_cast<double>(queueDepth());
+  }, labels_);
+
+  worker_ = std::thread(&AsyncSink::loop, this);
+}
+
+AsyncSink::~AsyncSink() {
+  running_.store(false);
+  {
+    std::lock_guard<std::mutex> lock(wakeMutex_);
+    wakeCv_.notify_one();
+  }
+  worker_.join();
+
+  MetricsRegistry::global().callback("logan_async_sink_queue_depth", "Records queued ahead of an async sink", MetricType::Gauge, [] {
+    return 0.0;
+  }, labels_);
+}
+
+std::string AsyncSink::name() const {
+  return sink_->name();
+}
+
+size_t AsyncSink::queueDepth() const {
+  return queue_.size();
+}
+
+uint64_t AsyncSink::droppedRecords() const {
+  return dropped_.value();
+}
+
+bool AsyncSink::write(const LogRecord& record) {
+  return sampled() && enqueue(record);
+}
+
+size_t AsyncSink::writeBatch(const std::vector<LogRecord>& records) {
+  size_t taken = 0;
+  for (const auto& record : records) {
+    taken += write(record) ? 1 : 0;
+  }
+  return taken;
+}
+
+// Keeps record n when (n + 1) * rate reaches the next whole number, which
+// forwards exactly `rate` of the records with even gaps
+bool AsyncSink::sampled() {
+  if (options_.sampleRate >= 1.0) {
+    return true;
+  }
+  uint64_t n = offered_.fetch_add(1, std::memory_order_relaxed);
+  return static_cast<uint64_t>((n + 1) * options_.sampleRate) > static_cast<uint64_t>(n * options_.sampleRate);
+}
+
+bool AsyncSink::enqueue(const LogRecord& record) {
+  if (!queue_.tryPush(record)) {
+    bool queued = false;
+    if (options_.overflow == AsyncOverflow::Block) {
+      auto deadline = std::chrono::steady_clock::now() + options_.blockTimeout;
+      while (!queued && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        queued = queue_.tryPush(record);
+      }
+    }
+    if (!queued) {
+      dropped_.add();
+      return false;
+    }
+  }
+
+  // Same handshake as FileSink: either the worker sees the record before
+  // sleeping, or we see it asleep and wake it
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (workerSleeping_.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(wakeMutex_);
+    wakeCv_.notify_one();
+  }
+  return true;
+}
+
+void AsyncSink::loop() {
+  LogRecord record;
+  while (running_ || !queue_.empty()) {
+    batch_.clear();
+    while (batch_.size() < options_.maxBatch && queue_.tryPop(record)) {
+      batch_.push_back(std::move(record));
+    }
+
+    if (!batch_.empty()) {
+      try {
+        ScopedTimer timer(writes_);
+        sink_->writeBatch(batch_);
+      } catch (const std::exception&) {
+        errors_.add();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(wakeMutex_);
+    workerSleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wakeCv_.wait_for(lock, std::chrono::seconds(1), [&] {
+      return !queue_.empty() || !running_;
+    });
+    workerSleeping_.store(false, std::memory_order_relaxed);
+  }
+}
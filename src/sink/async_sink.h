@@ -0,0 +1,69 @@
+#pragma once
+
+#include "sink.h"
+#include "../concurrency/mpsc_ring.h"
+#include "../logging/log_record.h"
+#include "../metrics/metrics.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// What write() does when the queue is full
+enum class AsyncOverflow {
+  Drop,                                                     // Discard the incoming record
+  Block                                                     // Wait up to `blockTimeout`, then discard it
+};
+
+struct AsyncSinkOptions {
+  size_t queueCapacity = 8192;                              // Rounded up to a power of two
+  size_t maxBatch = 1024;                                   // Records handed to the sink per writeBatch() at most
+  AsyncOverflow overflow = AsyncOverflow::Drop;
+  std::chrono::milliseconds blockTimeout{100};
+  double sampleRate = 1.0;                                  // Fraction of records forwarded, spread evenly
+};
+
+// Runs another sink on its own thread behind a bounded queue, so a slow or
+// failing sink never adds latency to ingestion or holds up the other sinks.
+// What the queue has no room for is dropped and counted; exceptions thrown by
+// the sink are counted and the batch is lost.
+class AsyncSink : public Sink {
+public:
+  explicit AsyncSink(std::shared_ptr<Sink> sink, AsyncSinkOptions options = {});
+  ~AsyncSink() override;                                    // Hands what is queued to the sink, then stops
+
+  std::string name() const override;
+
+  bool write(const LogRecord& record) override;
+  size_t writeBatch(const std::vector<LogRecord>& records) override;
+
+  size_t queueDepth() const;
+  uint64_t droppedRecords() const;
+
+private:
+  bool sampled();
+  bool enqueue(const LogRecord& record);
+  void loop();
+
+  std::shared_ptr<Sink> sink_;
+  AsyncSinkOptions options_;
+  std::string labels_;
+
+  MpscRing<LogRecord> queue_;
+  std::vector<LogRecord> batch_;                            // Worker-owned
+  std::atomic<uint64_t> offered_;                           // Records seen by write(), for sampling
+  std::atomic<bool> workerSleeping_;
+  std::mutex wakeMutex_;
+  std::condition_variable wakeCv_;
+  std::atomic<bool> running_;
+
+  Counter& dropped_;
+  Counter& errors_;
+  Histogram& writes_;
+
+  std::thread worker_;
+};
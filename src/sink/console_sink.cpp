@@ -1,12 +1,41 @@
 #include "console_sink.h"
 #include "../logging/log_record.h"
-#include <iostream>
+#include <cstdio>
 
 std::string ConsoleSink::name() const {
   return "ConsoleSink";
 }
 
-void ConsoleSink::write(const LogRecord& record) {
-  std::cout << "Record: " << record.timestamp << " " << record.service << " " << logLevelToString(record.level)
-            << " " << record.message << std::endl;
+bool ConsoleSink::write(const LogRecord& record) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  append(record);
+  flush();
+  return true;
+}
+
+size_t ConsoleSink::writeBatch(const std::vector<LogRecord>& records) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& record : records) {
+    append(record);
+  }
+  flush();
+  return records.size();
+}
+
+void ConsoleSink::append(const LogRecord& record) {
+  buffer_ += "Record: ";
+  buffer_ += std::to_string(record.timestamp);
+  buffer_ += ' ';
+  buffer_ += record.service;
+  buffer_ += ' ';
+  buffer_ += logLevelToString(record.level);
+  buffer_ += ' ';
+  buffer_ += record.message;
+  buffer_ += '\n';
+}
+
+void ConsoleSink::flush() {
+  std::fwrite(buffer_.data(), 1, buffer_.size(), stdout);
+  std::fflush(stdout);
+  buffer_.clear();
 }
@@ -1,12 +1,25 @@
 #pragma once
 
 #include "sink.h"
+#include <mutex>
+#include <string>
 
+// Prints records to stdout. A batch is formatted into one buffer and written
+// with a single call, so output is neither flushed per record nor
+// interleaved between threads. Meant to run behind an AsyncSink.
 class ConsoleSink : public Sink {
 public:
   ~ConsoleSink() override = default;
 
   std::string name() const override;
 
-  void write(const LogRecord& record) override;
+  bool write(const LogRecord& record) override;
+  size_t writeBatch(const std::vector<LogRecord>& records) override;
+
+private:
+  void append(const LogRecord& record);
+  void flush();
+
+  std::mutex mutex_;
+  std::string buffer_;
 };
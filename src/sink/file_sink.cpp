@@ -1,23 +1,97 @@
 #include "file_sink.h"
 #include "../logging/log_record.h"
+#include "../metrics/metrics.h"
+#include "../storage/segment_directory.h"
+#include "../storage/segment_maintenance.h"
+#include "../storage/segment_recovery.h"
 #include "../../include/errors/http_error.h"
 #include <chrono>
-#include <fstream>
+#include <exception>
+#include <filesystem>
+#include <limits>
 #include <mutex>
+#include <optional>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <system_error>
 #include <thread>
+#include <unistd.h>
+#include <utility>
 
-FileSink::FileSink(const std::string& path)
-  : running_(true), file_(path, std::ios::app) {
-  worker_ = std::thread(&FileSink::loop, this); // Are all of these needed
-  if (!file_.is_open()) {
-    throw HttpError(500, "Failed to open log file");
+namespace {
+
+struct SinkMetrics {
+  Counter& records = MetricsRegistry::global().counter("logan_sink_written_records_total", "Records written to segment files");
+  Counter& bytes = MetricsRegistry::global().counter("logan_sink_written_bytes_total", "Bytes written to segment files");
+  Counter& rejected = MetricsRegistry::global().counter("logan_sink_rejected_records_total", "Records refused with 503 because the queue was full");
+  Counter& rolls = MetricsRegistry::global().counter("logan_sink_segment_rolls_total", "New segments started");
+  Counter& expired = MetricsRegistry::global().counter("logan_sink_expired_segments_total", "Segments deleted by retention");
+  Counter& compacted = MetricsRegistry::global().counter("logan_sink_compacted_segments_total", "Segments merged by compaction");
+  Histogram& flush = MetricsRegistry::global().histogram("logan_sink_flush_seconds", "Time to write one group of queued records");
+  Histogram& sync = MetricsRegistry::global().histogram("logan_sink_sync_seconds", "Time of one fdatasync of the active segment");
+};
+
+SinkMetrics& metrics() {
+  static SinkMetrics metrics;
+  return metrics;
+}
+
+}
+
+FileSink::FileSink(const std::string& directory, FileSinkOptions options, std::shared_ptr<RollupStore> rollups)
+  : directory_(directory),
+    options_(options),
+    rollups_(std::move(rollups)),
+    queue_(options.queueCapacity),
+    batch_(std::max<size_t>(options.indexInterval, 1)),
+    writerSleeping_(false),
+    spaceWaiters_(0),
+    dropped_(0),
+    consumed_(0),
+    dirty_(false),
+    lastSync_(std::chrono::steady_clock::now()),
+    durable_(0),
+    failed_(false),
+    durableWaiters_(0),
+    running_(true),
+    activeSequence_(0) {
+  std::error_code ec;
+  std::filesystem::create_directories(directory_, ec);
+  if (ec) {
+    throw HttpError(500, "Failed to create log directory");
   }
+
+  // Only the newest segment can have a torn tail from a crash. A fresh segment
+  // is always started, so existing sidecars are only rebuilt if corrupt.
+  auto existing = listSegments(directory_);
+  if (!existing.empty()) {
+    recoverSegment(existing.back());
+  }
+  for (const auto& segment : existing) {
+    repairIndex(segment, options_.indexInterval);
+  }
+  uint64_t sequence = existing.empty() ? 1 : existing.back().sequence + 1;
+  segment_ = std::make_unique<SegmentWriter>(directory_, sequence, segmentOptions());
+  activeSequence_.store(sequence);
+  if (options_.durability != Durability::None) {
+    syncDirectory(directory_);
+  }
+
+  worker_ = std::thread(&FileSink::loop, this);
 }
 
 FileSink::~FileSink() {
   shutdown();
-  file_.close();
   worker_.join();
+  if (maintainer_.joinable()) {
+    maintainer_.join();
+  }
+}
+
+void FileSink::startMaintenance() {
+  if (!maintainer_.joinable() && (options_.retentionAge.count() > 0 || options_.retentionBytes > 0 || options_.compaction)) {
+    maintainer_ = std::thread(&FileSink::maintain, this);
+  }
 }
 
 std::string FileSink::name() const {
@@ -26,40 +100,274 @@ std::string FileSink::name() const {
 
 void FileSink::shutdown() {
   running_.store(false);
-  cv_.notify_one();
+  {
+    std::lock_guard<std::mutex> lock(maintenanceMutex_);
+    maintenanceCv_.notify_one();
+  }
+  std::lock_guard<std::mutex> lock(wakeMutex_);
+  wakeCv_.notify_one();
 }
 
-void FileSink::write(const LogRecord& log) {
-  {
-    std::lock_guard<std::mutex> lock(mutex_);
-    buffer_.push_back(log);
+size_t FileSink::queueDepth() const {
+  return queue_.size();
+}
+
+size_t FileSink::queueCapacity() const {
+  return queue_.capacity();
+}
+
+uint64_t FileSink::droppedRecords() const {
+  return dropped_.load(std::memory_order_relaxed);
+}
+
+void FileSink::setAcceptedSink(std::shared_ptr<Sink> sink) {
+  accepted_ = std::move(sink);
+}
+
+void FileSink::setRetiredDirectories(std::vector<std::string> directories) {
+  retired_ = std::move(directories);
+}
+
+bool FileSink::write(const LogRecord& log) {
+  uint64_t position = 0;
+  if (!enqueue(&log, 1, position)) {
+    return false;
   }
-  cv_.notify_one();
+  if (accepted_) {
+    accepted_->write(log);
+  }
+  if (options_.durability == Durability::GroupCommit) {
+    waitDurable(position);
+  }
+  return true;
 }
 
-void FileSink::loop() {
-  while (running_ || !buffer_.empty()) {
-    std::vector<LogRecord> local;
+size_t FileSink::writeBatch(const std::vector<LogRecord>& logs) {
+  if (logs.empty()) {
+    return 0;
+  }
+  if (logs.size() > queue_.capacity()) {
+    metrics().rejected.add(logs.size());
+    throw HttpError(413, "Batch is larger than the log queue");
+  }
 
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t first = 0;
+  if (!enqueue(logs.data(), logs.size(), first)) {
+    return 0;
+  }
+  if (accepted_) {
+    accepted_->writeBatch(logs);
+  }
+  if (options_.durability == Durability::GroupCommit) {
+    waitDurable(first + logs.size() - 1);
+  }
+  return logs.size();
+}
+
+// A batch goes into the queue whole or not at all, so a 503 means none of it
+// was written and the client can retry it without duplicating records
+bool FileSink::enqueue(const LogRecord* logs, size_t count, uint64_t& first) {
+  if (!queue_.tryPushAll(logs, count, &first)) {
+    switch (options_.overflowPolicy) {
+      case OverflowPolicy::DropNewest:
+        dropped_.fetch_add(count, std::memory_order_relaxed);
+        return false;
+      case OverflowPolicy::Reject:
+        metrics().rejected.add(count);
+        throw HttpError(503, "Log queue is full");
+      case OverflowPolicy::Block:
+        waitForSpace(logs, count, first);
+        break;
+    }
+  }
+
+  // Pairs with the fence in loop(): either the writer sees these records
+  // before sleeping, or we see it asleep and wake it
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (writerSleeping_.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(wakeMutex_);
+    wakeCv_.notify_one();
+  }
+  return true;
+}
 
-      cv_.wait_for(
-        lock,
-        std::chrono::seconds(1),
-        [&] {
-          return !buffer_.empty() || !running_;
-        }
-      );
+void FileSink::waitForSpace(const LogRecord* logs, size_t count, uint64_t& first) {
+  auto deadline = std::chrono::steady_clock::now() + options_.blockTimeout;
 
-      local.swap(buffer_);
+  spaceWaiters_.fetch_add(1);
+  std::unique_lock<std::mutex> lock(spaceMutex_);
+  while (!queue_.tryPushAll(logs, count, &first)) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      spaceWaiters_.fetch_sub(1);
+      metrics().rejected.add(count);
+      throw HttpError(503, "Log queue is full");
     }
+    spaceCv_.wait_for(lock, std::chrono::milliseconds(10));  // Re-polls in case a wakeup raced the wait
+  }
+  spaceWaiters_.fetch_sub(1);
+}
 
-    for (const auto& log : local) {
-      file_ << log.timestamp << " " << log.service << " " << static_cast<int>(log.level) << " " << log.message << "\n";
+void FileSink::waitDurable(uint64_t position) {
+  if (durable_.load() <= position && !failed_.load()) {
+    durableWaiters_.fetch_add(1);
+    std::unique_lock<std::mutex> lock(durableMutex_);
+    durableCv_.wait(lock, [&] {
+      return durable_.load() > position || failed_.load();
+    });
+    durableWaiters_.fetch_sub(1);
+  }
+
+  if (failed_.load()) {
+    throw HttpError(500, "Failed to persist log");
+  }
+}
+
+SegmentOptions FileSink::segmentOptions() const {
+  SegmentOptions segment;
+  segment.indexInterval = options_.indexInterval;
+  segment.format = options_.format;
+  segment.trigramIndex = options_.trigramIndex;
+  return segment;
+}
+
+void FileSink::rollIfNeeded() {
+  bool full = segment_->bytes() >= options_.maxSegmentBytes;
+  bool old = std::chrono::steady_clock::now() - segment_->openedAt() >= options_.maxSegmentAge;
+  if ((full || old) && segment_->bytes() > 0) {
+    commit(true);                                           // Nothing unsynced may be left behind in a closed segment
+    uint64_t next = segment_->sequence() + 1;
+    segment_ = std::make_unique<SegmentWriter>(directory_, next, segmentOptions());
+    activeSequence_.store(next);
+    metrics().rolls.add();
+    if (options_.durability != Durability::None) {
+      syncDirectory(directory_);
     }
+  }
+}
+
+void FileSink::maintain() {
+  // Compaction is bulk work that must not slow down ingest or queries
+  ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), 19);
+
+  MaintenanceOptions maintenance;
+  maintenance.retentionAge = options_.retentionAge;
+  maintenance.retentionBytes = options_.retentionBytes;
+  maintenance.compaction = options_.compaction;
+  maintenance.compactTargetBytes = options_.maxSegmentBytes;
+  maintenance.output = segmentOptions();
 
-    file_.flush();
+  ExpiredVisitor expired;
+  if (rollups_) {
+    expired = [this](const LogRecordView& log) {
+      rollups_->remove(log);
+    };
+  }
+
+  std::unique_lock<std::mutex> lock(maintenanceMutex_);
+  while (!maintenanceCv_.wait_for(lock, options_.maintenanceInterval, [&] { return !running_; })) {
+    lock.unlock();
+    auto pass = [&](const std::string& directory, uint64_t active) {
+      try {
+        auto result = maintainSegments(directory, active, maintenance, expired);
+        metrics().expired.add(result.expired);
+        metrics().compacted.add(result.compacted);
+      } catch (const std::exception&) {
+        // A segment that cannot be written now is retried on the next pass
+      }
+    };
+    pass(directory_, activeSequence_.load());
+    for (const auto& directory : retired_) {
+      pass(directory, std::numeric_limits<uint64_t>::max());  // Nothing is written there
+    }
+    lock.lock();
   }
 }
 
+size_t FileSink::drain() {
+  auto start = std::chrono::steady_clock::now();
+  size_t drained = 0;
+  while (drained < options_.maxGroupRecords) {
+    size_t count = 0;
+    while (count < batch_.size() && queue_.tryPop(batch_[count])) {
+      ++count;
+    }
+    if (count == 0) {
+      break;
+    }
+
+    rollIfNeeded();
+    uint64_t before = segment_->bytes();
+    if (!segment_->append(batch_.data(), count)) {
+      failed_.store(true);
+    } else if (rollups_) {
+      rollups_->add(batch_.data(), count);
+    }
+    metrics().records.add(count);
+    metrics().bytes.add(segment_->bytes() - before);
+    consumed_ += count;
+    drained += count;
+    dirty_ = true;
+  }
+
+  if (drained > 0) {
+    metrics().flush.observe(std::chrono::steady_clock::now() - start);
+  }
+  if (drained > 0 && spaceWaiters_.load() > 0) {
+    std::lock_guard<std::mutex> lock(spaceMutex_);
+    spaceCv_.notify_all();
+  }
+  return drained;
+}
+
+void FileSink::commit(bool force) {
+  auto now = std::chrono::steady_clock::now();
+
+  if (dirty_ && options_.durability != Durability::None) {
+    bool due = force ||
+      options_.durability == Durability::GroupCommit ||
+      now - lastSync_ >= options_.syncInterval;
+    if (!due) {
+      return;
+    }
+    {
+      ScopedTimer timer(metrics().sync);
+      if (!segment_->sync()) {
+        failed_.store(true);
+      }
+    }
+    lastSync_ = now;
+  }
+  dirty_ = false;
+
+  durable_.store(consumed_);
+  if (durableWaiters_.load() > 0) {
+    std::lock_guard<std::mutex> lock(durableMutex_);
+    durableCv_.notify_all();
+  }
+}
+
+void FileSink::loop() {
+  while (running_ || !queue_.empty()) {
+    rollIfNeeded();
+
+    if (drain() > 0) {
+      commit(false);
+      continue;                                             // Keep draining while records are queued
+    }
+    commit(false);                                          // Interval syncs that came due while idle
+
+    std::unique_lock<std::mutex> lock(wakeMutex_);
+    writerSleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wakeCv_.wait_for(
+      lock,
+      std::min<std::chrono::milliseconds>(options_.syncInterval, std::chrono::seconds(1)),
+      [&] {
+        return !queue_.empty() || !running_;
+      }
+    );
+    writerSleeping_.store(false, std::memory_order_relaxed);
+  }
+
+  commit(true);
+}
@@ -1,31 +1,135 @@
 #pragma once
 
 #include "../logging/log_record.h"
+#include "../concurrency/mpsc_ring.h"
+#include "../querying/rollup_store.h"
+#include "../storage/segment_writer.h"
 #include "sink.h"
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
-#include <fstream>
+#include <cstdint>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
+// What write() does when the queue is full. A batch is queued whole or not
+// at all, so a rejected (503) or dropped batch left nothing behind.
+enum class OverflowPolicy {
+  Block,                                                    // Wait up to `blockTimeout`, then reject
+  DropNewest,                                               // Discard the incoming record or batch
+  Reject                                                    // Fail the request with 503
+};
+
+// When written records are fsynced
+enum class Durability {
+  None,                                                     // Leave write-back to the OS
+  Interval,                                                 // fdatasync at most every `syncInterval`
+  GroupCommit                                               // fdatasync each drained group before write() returns
+};
+
+struct FileSinkOptions {
+  uint64_t maxSegmentBytes = 64 * 1024 * 1024;              // Roll to a new segment past this size
+  std::chrono::seconds maxSegmentAge{3600};                 // ... or once the segment is this old
+  uint32_t indexInterval = 1024;                            // Records per indexed block
+  size_t queueCapacity = 65536;                             // Records buffered ahead of the writer (rounded up to a power of two)
+  OverflowPolicy overflowPolicy = OverflowPolicy::Block;
+  std::chrono::milliseconds blockTimeout{1000};
+  Durability durability = Durability::Interval;
+  std::chrono::milliseconds syncInterval{1000};
+  size_t maxGroupRecords = 65536;                           // Records written between two group-commit syncs at most
+  StorageFormat format = StorageFormat::Text;               // Format of newly created segments
+  bool trigramIndex = false;                                // Index message trigrams to prune substring searches
+  std::chrono::seconds retentionAge{0};                     // Delete closed segments not written to for this long; 0 keeps them
+  uint64_t retentionBytes = 0;                              // Delete the oldest closed segments past this total size; 0 keeps them
+  bool compaction = false;                                  // Merge closed text and small segments into block segments
+  std::chrono::seconds maintenanceInterval{10};             // Between retention and compaction passes
+};
+
 class FileSink : public Sink {
 public:
-  explicit FileSink(const std::string& path);
+  // `rollups`, if given, is updated with every batch written
+  explicit FileSink(const std::string& directory, FileSinkOptions options = {}, std::shared_ptr<RollupStore> rollups = nullptr);
   ~FileSink() override;
 
   std::string name() const override;
   
+  // Starts the retention and compaction thread, if either is enabled. Called
+  // once `rollups` hold the existing segments, or the records retention
+  // removes from them would never have been added.
+  void startMaintenance();
+
   void shutdown();
-  void write(const LogRecord& log) override;
+  // False, and 0 from writeBatch, when DropNewest discarded the records.
+  // Throws HttpError(413) for a batch larger than the queue could ever hold.
+  bool write(const LogRecord& log) override;
+  size_t writeBatch(const std::vector<LogRecord>& logs) override;
+
+  // `sink` is handed every record or batch once it is queued, and nothing
+  // that was dropped or rejected, so it holds what the segments will. Set
+  // before ingestion starts.
+  void setAcceptedSink(std::shared_ptr<Sink> sink);
+
+  // Directories no writer uses any more, such as shards left by a run with
+  // more of them. Maintenance applies retention and compaction to them too.
+  // Set before startMaintenance().
+  void setRetiredDirectories(std::vector<std::string> directories);
+
+  size_t queueDepth() const;
+  size_t queueCapacity() const;
+  uint64_t droppedRecords() const;
 
 private:
+  bool enqueue(const LogRecord* logs, size_t count, uint64_t& first);
+  void waitForSpace(const LogRecord* logs, size_t count, uint64_t& first);
+  void waitDurable(uint64_t position);
   void loop();
+  size_t drain();
+  void commit(bool force);
+  void rollIfNeeded();
+  void maintain();
+  SegmentOptions segmentOptions() const;
+
+  std::string directory_;
+  FileSinkOptions options_;
+  std::unique_ptr<SegmentWriter> segment_;
+  std::shared_ptr<RollupStore> rollups_;
+  std::shared_ptr<Sink> accepted_;
+
+  // Producers never lock on the fast path. The mutexes below are only taken
+  // to wake a sleeping writer or a producer blocked on a full queue.
+  MpscRing<LogRecord> queue_;
+  std::vector<LogRecord> batch_;                            // Writer-owned; swapped with queue slots to recycle buffers
+  std::atomic<bool> writerSleeping_;
+  std::mutex wakeMutex_;
+  std::condition_variable wakeCv_;
+  std::atomic<size_t> spaceWaiters_;
+  std::mutex spaceMutex_;
+  std::condition_variable spaceCv_;
+  std::atomic<uint64_t> dropped_;
+
+  // Queue positions below `durable_` are synced to disk. A failed write or
+  // sync is sticky: group-commit writers fail from then on, since it is no
+  // longer known which records reached the disk.
+  uint64_t consumed_;                                       // Writer-only: records taken off the queue
+  bool dirty_;                                              // Writer-only: written since the last sync
+  std::chrono::steady_clock::time_point lastSync_;          // Writer-only
+  std::atomic<uint64_t> durable_;
+  std::atomic<bool> failed_;
+  std::atomic<size_t> durableWaiters_;
+  std::mutex durableMutex_;
+  std::condition_variable durableCv_;
 
-  std::vector<LogRecord> buffer_;
-  std::ofstream file_;
-  std::mutex mutex_;
-  std::condition_variable cv_;
-  std::thread worker_;
   std::atomic<bool> running_;
+  std::thread worker_;
+
+  // Retention and compaction run on their own low-priority thread and only
+  // touch segments before the one being written
+  std::atomic<uint64_t> activeSequence_;
+  std::vector<std::string> retired_;
+  std::mutex maintenanceMutex_;
+  std::condition_variable maintenanceCv_;
+  std::thread maintainer_;
 };
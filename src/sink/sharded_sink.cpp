@@ -0,0 +1,137 @@
+#include "sharded_sink.h"
+#include "../../include/errors/http_error.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+
+namespace {
+
+size_t threadSlot() {
+  static std::atomic<size_t> next{0};
+  thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+  return slot;
+}
+
+}
+
+ShardedSink::ShardedSink(const std::vector<std::string>& directories, FileSinkOptions options, std::shared_ptr<RollupStore> rollups, ShardRouting routing)
+  : routing_(routing), nextBatch_(0) {
+  if (directories.empty()) {
+    throw HttpError(500, "No shard directories configured");
+  }
+
+  if (options.retentionBytes > 0) {
+    options.retentionBytes = std::max<uint64_t>(options.retentionBytes / directories.size(), 1);
+  }
+  for (const auto& directory : directories) {
+    shards_.push_back(std::make_unique<FileSink>(directory, options, rollups));
+  }
+}
+
+std::string ShardedSink::name() const {
+  return "ShardedSink";
+}
+
+bool ShardedSink::write(const LogRecord& log) {
+  return shards_[route(log)]->write(log);
+}
+
+size_t ShardedSink::writeBatch(const std::vector<LogRecord>& logs) {
+  // Batches rotate rather than follow their thread, so a single submitter
+  // such as the raw listener still spreads over every shard
+  if (shards_.size() == 1 || routing_ == ShardRouting::Thread) {
+    return shards_[nextBatch_.fetch_add(1, std::memory_order_relaxed) % shards_.size()]->writeBatch(logs);
+  }
+
+  std::vector<std::vector<LogRecord>> parts(shards_.size());
+  for (const auto& log : logs) {
+    parts[route(log)].push_back(log);
+  }
+  size_t taken = 0;
+  for (size_t i = 0; i < parts.size(); ++i) {
+    if (!parts[i].empty()) {
+      taken += shards_[i]->writeBatch(parts[i]);
+    }
+  }
+  return taken;
+}
+
+void ShardedSink::setAcceptedSink(const std::shared_ptr<Sink>& sink) {
+  for (const auto& shard : shards_) {
+    shard->setAcceptedSink(sink);
+  }
+}
+
+void ShardedSink::setRetiredDirectories(const std::vector<std::string>& directories) {
+  shards_.front()->setRetiredDirectories(directories);
+}
+
+void ShardedSink::startMaintenance() {
+  for (const auto& shard : shards_) {
+    shard->startMaintenance();
+  }
+}
+
+size_t ShardedSink::route(const LogRecord& log) const {
+  if (routing_ == ShardRouting::Service) {
+    return serviceIdOf(log) % shards_.size();
+  }
+  return threadSlot() % shards_.size();
+}
+
+size_t ShardedSink::shardCount() const {
+  return shards_.size();
+}
+
+size_t ShardedSink::queueDepth() const {
+  size_t depth = 0;
+  for (const auto& shard : shards_) {
+    depth += shard->queueDepth();
+  }
+  return depth;
+}
+
+size_t ShardedSink::queueCapacity() const {
+  size_t capacity = 0;
+  for (const auto& shard : shards_) {
+    capacity += shard->queueCapacity();
+  }
+  return capacity;
+}
+
+uint64_t ShardedSink::droppedRecords() const {
+  uint64_t dropped = 0;
+  for (const auto& shard : shards_) {
+    dropped += shard->droppedRecords();
+  }
+  return dropped;
+}
+
+std::vector<std::string> shardDirectories(const std::string& root, size_t shards) {
+  std::vector<std::string> directories{root};
+  for (size_t i = 1; i < shards; ++i) {
+    directories.push_back(root + "/shard-" + std::to_string(i));
+  }
+  return directories;
+}
+
+std::vector<std::string> readableShardDirectories(const std::string& root, size_t shards) {
+  auto directories = shardDirectories(root, shards);
+
+  std::vector<std::pair<unsigned long, std::string>> leftover;
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(root, ec)) {
+    unsigned long index;
+    char tail;
+    if (entry.is_directory() && std::sscanf(entry.path().filename().string().c_str(), "shard-%lu%c", &index, &tail) == 1 && index >= shards) {
+      leftover.emplace_back(index, entry.path().string());
+    }
+  }
+  std::sort(leftover.begin(), leftover.end());
+  for (auto& [index, directory] : leftover) {
+    directories.push_back(std::move(directory));
+  }
+  return directories;
+}
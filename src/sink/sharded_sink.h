@@ -0,0 +1,65 @@
+#pragma once
+
+#include "file_sink.h"
+#include "sink.h"
+#include "../logging/log_record.h"
+#include "../querying/rollup_store.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Which shard a record is written to
+enum class ShardRouting {
+  Thread,                                                   // Records by submitting thread, batches round-robin; a batch stays together
+  Service                                                   // By service, so each service's records stay in one shard in order
+};
+
+// Spreads ingestion over several FileSinks, each with its own queue, writer
+// thread and directory (possibly on its own disk), so write throughput is
+// not capped by what one writer thread can format and flush. Every shard
+// directory is read by its own FileSource. Each shard queues its part of a
+// batch whole or not at all, but with Service routing a batch spans shards,
+// so a 503 from one may leave the parts for the others written, and under
+// DropNewest writeBatch() may report only part of a batch as taken.
+class ShardedSink : public Sink {
+public:
+  // One shard per directory. `options` apply to each shard, except that
+  // `retentionBytes` is split evenly so it still bounds the total.
+  ShardedSink(const std::vector<std::string>& directories, FileSinkOptions options = {}, std::shared_ptr<RollupStore> rollups = nullptr, ShardRouting routing = ShardRouting::Thread);
+
+  std::string name() const override;
+
+  bool write(const LogRecord& log) override;
+  size_t writeBatch(const std::vector<LogRecord>& logs) override;
+
+  // Set on every shard, so `sink` gets each shard's part as it is queued
+  void setAcceptedSink(const std::shared_ptr<Sink>& sink);
+  // Maintained by the first shard, see FileSink::setRetiredDirectories()
+  void setRetiredDirectories(const std::vector<std::string>& directories);
+  void startMaintenance();
+
+  size_t shardCount() const;
+
+  // Summed over the shards
+  size_t queueDepth() const;
+  size_t queueCapacity() const;
+  uint64_t droppedRecords() const;
+
+private:
+  size_t route(const LogRecord& log) const;
+
+  std::vector<std::unique_ptr<FileSink>> shards_;
+  ShardRouting routing_;
+  std::atomic<size_t> nextBatch_;
+};
+
+// Shard directories under `root`: the first shard writes to `root` itself,
+// so existing segments stay where they are, the others to `root/shard-N`
+std::vector<std::string> shardDirectories(const std::string& root, size_t shards);
+
+// `shardDirectories(root, shards)` plus any `root/shard-N` an earlier run
+// with more shards left behind, so their records stay readable. The
+// leftovers come last; give them to setRetiredDirectories().
+std::vector<std::string> readableShardDirectories(const std::string& root, size_t shards);
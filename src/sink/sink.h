@@ -1,7 +1,9 @@
 #pragma once
 
 #include "../logging/log_record.h"
+#include <cstddef>
 #include <string>
+#include <vector>
 
 class Sink {
 public:
@@ -9,5 +11,16 @@ public:
 
   virtual std::string name() const = 0;
   
-  virtual void write(const LogRecord& record) = 0;
+  // False if the record was dropped rather than taken
+  virtual bool write(const LogRecord& record) = 0;
+
+  // Sinks with their own queue should take the whole batch in one enqueue.
+  // Returns how many of the records were taken.
+  virtual size_t writeBatch(const std::vector<LogRecord>& records) {
+    size_t taken = 0;
+    for (const auto& record : records) {
+      taken += write(record) ? 1 : 0;
+    }
+    return taken;
+  }
 };
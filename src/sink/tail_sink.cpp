@@ -0,0 +1,128 @@
+#include "tail_sink.h"
+#include "../../include/errors/http_error.h"
+#include <algorithm>
+
+TailSubscription::TailSubscription(const QueryParams& filter, size_t capacity, TailOverflow overflow)
+  : filter_(filter),
+    text_(filter),
+    capacity_(std::max<size_t>(capacity, 1)),
+    overflow_(overflow) {
+  if (filter.service) {
+    service_ = ServiceTable::global().find(filter.service.value());
+  }
+}
+
+bool TailSubscription::matches(const LogRecord& record) const {
+  if (filter_.level && filter_.level.value() != record.level) return false;
+  if (filter_.from && filter_.from.value() > record.timestamp) return false;
+  if (filter_.to && filter_.to.value() < record.timestamp) return false;
+  if (filter_.service) {
+    // A service unknown when subscribing has no id yet, so compare names
+    bool same = service_ ? service_.value() == serviceIdOf(record) : filter_.service.value() == record.service;
+    if (!same) return false;
+  }
+  return !text_.active() || text_.matches(record.message);
+}
+
+void TailSubscription::push(const LogRecord& record) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+      return;
+    }
+    if (buffer_.size() >= capacity_) {
+      if (overflow_ == TailOverflow::Disconnect) {
+        closed_ = true;
+        ready_.notify_one();
+        return;
+      }
+      buffer_.pop_front();
+      ++dropped_;
+    }
+    buffer_.push_back(record);
+  }
+  ready_.notify_one();
+}
+
+bool TailSubscription::take(std::vector<LogRecord>& out, uint64_t& dropped, std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ready_.wait_for(lock, timeout, [&] {
+    return !buffer_.empty() || closed_;
+  });
+
+  out.insert(out.end(), std::make_move_iterator(buffer_.begin()), std::make_move_iterator(buffer_.end()));
+  buffer_.clear();
+  dropped = dropped_;
+  dropped_ = 0;
+  return !closed_ || !out.empty();
+}
+
+void TailSubscription::close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closed_ = true;
+  ready_.notify_one();
+}
+
+TailSink::TailSink(TailSinkOptions options)
+  : options_(options), count_(0) {}
+
+std::string TailSink::name() const {
+  return "TailSink";
+}
+
+bool TailSink::write(const LogRecord& record) {
+  if (count_.load(std::memory_order_relaxed) == 0) {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& subscriber : subscribers_) {
+    if (subscriber->matches(record)) {
+      subscriber->push(record);
+    }
+  }
+  return true;
+}
+
+size_t TailSink::writeBatch(const std::vector<LogRecord>& records) {
+  if (count_.load(std::memory_order_relaxed) == 0) {
+    return records.size();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& record : records) {
+    for (const auto& subscriber : subscribers_) {
+      if (subscriber->matches(record)) {
+        subscriber->push(record);
+      }
+    }
+  }
+  return records.size();
+}
+
+std::shared_ptr<TailSubscription> TailSink::subscribe(const QueryParams& filter) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (closed_) {
+    throw HttpError(503, "Shutting down");
+  }
+  if (subscribers_.size() >= options_.maxSubscribers) {
+    throw HttpError(503, "Too many tail subscribers");
+  }
+  auto subscription = std::make_shared<TailSubscription>(filter, options_.bufferRecords, options_.overflow);
+  subscribers_.push_back(subscription);
+  count_.store(subscribers_.size(), std::memory_order_relaxed);
+  return subscription;
+}
+
+void TailSink::unsubscribe(const std::shared_ptr<TailSubscription>& subscription) {
+  subscription->close();
+  std::lock_guard<std::mutex> lock(mutex_);
+  subscribers_.erase(std::remove(subscribers_.begin(), subscribers_.end(), subscription), subscribers_.end());
+  count_.store(subscribers_.size(), std::memory_order_relaxed);
+}
+
+void TailSink::shutdown() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closed_ = true;
+  for (const auto& subscriber : subscribers_) {
+    subscriber->close();
+  }
+}
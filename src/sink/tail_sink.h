@@ -0,0 +1,82 @@
+#pragma once
+
+#include "sink.h"
+#include "../logging/log_record.h"
+#include "../querying/query_params.h"
+#include "../querying/text_match.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// What happens when a subscriber's buffer is full
+enum class TailOverflow {
+  DropOldest,                                               // Make room by discarding its oldest buffered record
+  Disconnect                                                // Close the subscription
+};
+
+struct TailSinkOptions {
+  size_t bufferRecords = 1024;                              // Per subscriber
+  size_t maxSubscribers = 4;                                // Each open stream holds an HTTP worker, so keep well below their count
+  TailOverflow overflow = TailOverflow::DropOldest;
+};
+
+// One live-tail client. Records matching its filter are buffered by the
+// ingesting threads and taken off by the connection that streams them.
+class TailSubscription {
+public:
+  TailSubscription(const QueryParams& filter, size_t capacity, TailOverflow overflow);
+
+  // Waits up to `timeout` for records and moves all buffered ones to `out`.
+  // False once the subscription is closed and drained.
+  bool take(std::vector<LogRecord>& out, uint64_t& dropped, std::chrono::milliseconds timeout);
+  void close();
+
+private:
+  friend class TailSink;
+
+  bool matches(const LogRecord& record) const;
+  void push(const LogRecord& record);
+
+  QueryParams filter_;
+  std::optional<ServiceId> service_;                        // Unset if the service was unknown when subscribing
+  TextMatcher text_;
+  size_t capacity_;
+  TailOverflow overflow_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<LogRecord> buffer_;
+  uint64_t dropped_ = 0;                                    // Since the last take()
+  bool closed_ = false;
+};
+
+// Fans ingested records out to live-tail subscribers without touching disk
+class TailSink : public Sink {
+public:
+  explicit TailSink(TailSinkOptions options = {});
+
+  std::string name() const override;
+
+  bool write(const LogRecord& record) override;
+  size_t writeBatch(const std::vector<LogRecord>& records) override;
+
+  // Throws HttpError(503) when `maxSubscribers` are already connected
+  std::shared_ptr<TailSubscription> subscribe(const QueryParams& filter);
+  void unsubscribe(const std::shared_ptr<TailSubscription>& subscription);
+
+  // Closes every subscription so streaming connections finish
+  void shutdown();
+
+private:
+  TailSinkOptions options_;
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<TailSubscription>> subscribers_;
+  std::atomic<size_t> count_;                               // Lets write() skip the lock with no subscribers
+  bool closed_ = false;
+};
@@ -1,74 +1,777 @@
 #include "file_source.h"
+#include "../metrics/metrics.h"
+#include "../storage/block_format.h"
+#include "../storage/record_format.h"
+#include "../storage/segment_maintenance.h"
+#include "../storage/trigram_filter.h"
+#include "../querying/text_match.h"
 #include "../../include/errors/http_error.h"
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <string>
+#include <system_error>
+#include <tuple>
+#include <unordered_set>
 
-FileSource::FileSource(const std::string& path)
-  : file_(path) {
-  if (!file_.is_open()) {
-    throw HttpError(500, "Failed to open log file");
+namespace {
+
+struct SourceMetrics {
+  Counter& scannedBytes = MetricsRegistry::global().counter("logan_scan_bytes_total", "Segment bytes read by queries after index pruning");
+  Counter& segments = MetricsRegistry::global().counter("logan_scan_segments_total", "Segments read by queries");
+  Counter& malformed = MetricsRegistry::global().counter("logan_scan_malformed_lines_total", "Segment lines skipped because they did not parse");
+  Counter& replanned = MetricsRegistry::global().counter("logan_scan_replans_total", "Scans listed again because a segment was removed meanwhile");
+  Counter& cacheHits = MetricsRegistry::global().counter("logan_result_cache_hits_total", "Queries answered in part from the result cache");
+  Counter& cacheMisses = MetricsRegistry::global().counter("logan_result_cache_misses_total", "Queries with no usable result cache entry");
+};
+
+SourceMetrics& metrics() {
+  static SourceMetrics metrics;
+  return metrics;
+}
+
+// Like RecordVisitor, but also told the segment and the resume offset past
+// each record
+using PositionedVisitor = FileSource::PositionedVisitor;
+
+// Offsets (relative to the block) of the records that can satisfy the
+// service/level filters, or nullopt if the block has to be scanned.
+std::optional<std::vector<uint32_t>> selectRecords(const BlockEntry& block, const QueryParams& params) {
+  if (!block.hasPostings || (!params.service && !params.level)) {
+    return std::nullopt;
+  }
+
+  std::optional<std::vector<uint32_t>> selected;
+
+  if (params.service) {
+    const PostingList* postings = block.servicePostings(params.service.value());
+    if (!postings) {
+      return std::vector<uint32_t>{};
+    }
+    selected = decodePostings(*postings);
   }
+
+  if (params.level) {
+    auto levelOffsets = decodePostings(block.levels[static_cast<size_t>(params.level.value())]);
+    selected = selected ? intersectPostings(*selected, levelOffsets) : std::move(levelOffsets);
+  }
+
+  return selected;
 }
 
-FileSource::~FileSource() {
-  file_.close();
+uint64_t fileSize(const std::string& path) {
+  std::error_code ec;
+  uint64_t size = std::filesystem::file_size(path, ec);
+  return ec ? 0 : size;
 }
 
-std::string FileSource::name() const {
-  return "FileSource";
+// End of the last complete record (or block) in a segment's bytes, given that
+// the first `indexed` bytes are known to be complete
+uint64_t wholeRecordsEnd(std::string_view bytes, uint64_t indexed, StorageFormat format) {
+  if (format == StorageFormat::Text) {
+    size_t newline = bytes.rfind('\n');
+    return newline == std::string_view::npos ? 0 : newline + 1;
+  }
+
+  BlockDecoder decoder;
+  uint64_t end = indexed;
+  while (end < bytes.size() && decoder.open(bytes.substr(end))) {
+    end += decoder.size();
+  }
+  return end;
+}
+
+// Cursors name the segment range their offset belongs to. One into segments
+// that were compacted since is moved to the same record of the compacted
+// segment, or refused with 410 if its map can't place it.
+std::optional<QueryCursor> resumePoint(const std::optional<QueryCursor>& cursor, const std::vector<SegmentInfo>& segments) {
+  if (!cursor) {
+    return cursor;
+  }
+  uint64_t first = cursor->firstSegment.value_or(cursor->segment);
+  for (const auto& segment : segments) {
+    if (segment.firstSequence > cursor->segment || segment.sequence < cursor->segment) {
+      continue;
+    }
+    if (segment.sequence == cursor->segment && segment.firstSequence == first) {
+      return cursor;
+    }
+    auto offset = compactedOffset(segment, first, cursor->segment, cursor->offset);
+    if (!offset) {
+      throw HttpError(410, "The segment this cursor points into was compacted since; restart the query");
+    }
+    QueryCursor moved = *cursor;
+    moved.segment = segment.sequence;
+    moved.firstSegment = segment.firstSequence;
+    moved.offset = offset.value();
+    return moved;
+  }
+  return cursor;
+}
+
+void stampCursor(QueryCursor& cursor, const std::vector<SegmentInfo>& segments) {
+  for (const auto& segment : segments) {
+    if (segment.sequence == cursor.segment) {
+      cursor.firstSegment = segment.firstSequence != segment.sequence ? std::optional<uint64_t>(segment.firstSequence) : std::nullopt;
+      return;
+    }
+  }
 }
 
-std::vector<LogRecord> FileSource::query(const QueryParams& params) {
-  std::vector<LogRecord> logs;
+constexpr int kPlanAttempts = 3;
 
-  file_.clear();
-  file_.seekg(0, std::ios::beg);
+// A run of segment bytes to filter; `block` is set when its posting lists apply
+struct ScanTask {
+  std::string_view bytes;
+  const BlockEntry* block;
+  uint64_t segment;
+  uint64_t offset;                                          // Segment offset of `bytes`
+  StorageFormat format;
+  uint64_t resume;                                          // Column blocks: skip records positioned before this offset
+};
 
-  std::string line;
-  while (std::getline(file_, line)) {
-    if (line.empty()) continue;
+// Append-only storage for bytes that must outlive the buffer they were read
+// from. Contents never move, so views stay valid when the arena is moved.
+class Arena {
+public:
+  std::string_view store(std::string_view bytes) {
+    if (bytes.size() > kChunkBytes / 4) {
+      large_.push_back(std::make_unique<char[]>(bytes.size()));
+      std::copy(bytes.begin(), bytes.end(), large_.back().get());
+      return std::string_view(large_.back().get(), bytes.size());
+    }
+    if (chunks_.empty() || used_ + bytes.size() > kChunkBytes) {
+      chunks_.push_back(std::make_unique<char[]>(kChunkBytes));
+      used_ = 0;
+    }
+    char* out = chunks_.back().get() + used_;
+    std::copy(bytes.begin(), bytes.end(), out);
+    used_ += bytes.size();
+    return std::string_view(out, bytes.size());
+  }
 
-    std::istringstream iss(line);
+private:
+  static constexpr size_t kChunkBytes = 64 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  std::vector<std::unique_ptr<char[]>> large_;
+  size_t used_ = 0;
+};
+
+bool within(std::string_view outer, std::string_view inner) {
+  std::less_equal<const char*> notAfter;
+  return notAfter(outer.data(), inner.data()) && notAfter(inner.data() + inner.size(), outer.data() + outer.size());
+}
 
-    int64_t timestamp;
-    std::string service;
-    int levelInt;
-    std::string message;
+// Everything a scan worker needs to test records, built once per query
+struct ScanFilter {
+  const QueryParams& params;
+  RecordPredicate predicate;                                // The fields checked while parsing
+  TextMatcher text;
+  std::vector<uint32_t> trigrams;                           // Of the `q` substring, for block pruning
+};
 
-    if (!(iss >> timestamp >> service >> levelInt)) {
-      continue;                                             // Malformed
+RecordPredicate predicateOf(const QueryParams& params) {
+  RecordPredicate predicate{params.from, params.to, params.level, std::nullopt};
+  if (params.service) {
+    predicate.service = params.service.value();
+  }
+  return predicate;
+}
+
+// The message of an escaped record is unescaped into a per-thread buffer, so
+// it is only valid until the next line the thread matches
+bool matchLine(std::string_view line, const ScanFilter& filter, LogRecordView& log) {
+  if (line.empty()) return false;
+
+  RecordFields fields;
+  ParseResult result = parseRecord(line, filter.predicate, fields);
+  if (result != ParseResult::Match) {
+    if (result == ParseResult::Malformed) {
+      metrics().malformed.add();
     }
+    return false;
+  }
 
-    std::getline(iss >> std::ws, message);
+  std::string_view message = fields.message;
+  if (fields.escaped) {
+    thread_local std::string unescaped;
+    unescapeMessage(message, unescaped);
+    message = unescaped;
+  }
 
-    LogLevel level = static_cast<LogLevel>(levelInt);
+  if (filter.text.active() && !filter.text.matches(message)) {
+    return false;
+  }
 
-    if (params.level && params.level.value() != level) {
-      continue;
+  log.timestamp = fields.timestamp;
+  log.service = fields.service;
+  log.level = fields.level;
+  log.message = message;
+  return true;
+}
+
+// The scanners call `emit(record, next)` per match, where `next` is the segment
+// offset just past the record, and stop as soon as `emit` returns false.
+
+template <typename Emit>
+bool scanRange(const ScanTask& task, const ScanFilter& filter, Emit&& emit) {
+  std::string_view bytes = task.bytes;
+  LogRecordView log;
+
+  // With a substring filter, jump between occurrences of the needle and only
+  // parse the lines they fall in. A needle with a backslash or newline may
+  // only occur escaped, so it can't be searched for in the raw bytes.
+  const auto& substring = filter.text.substring();
+  const std::string* needle = substring && substring->find_first_of("\\\n") == std::string::npos ? &substring.value() : nullptr;
+
+  size_t pos = 0;
+  while (pos < bytes.size()) {
+    size_t lineStart = pos;
+    size_t lineScan = pos;
+    if (needle) {
+      size_t hit = findSubstring(bytes.substr(pos), *needle);
+      if (hit == std::string_view::npos) {
+        break;
+      }
+      size_t previous = bytes.rfind('\n', pos + hit);
+      lineStart = previous == std::string_view::npos || previous < pos ? pos : previous + 1;
+      lineScan = pos + hit;
     }
-    
-    if (params.from && params.from.value() > timestamp) {
-      continue;
+
+    size_t newline = bytes.find('\n', lineScan);
+    if (newline == std::string_view::npos) {
+      break;                                                // Partially written line
+    }
+    if (matchLine(bytes.substr(lineStart, newline - lineStart), filter, log) && !emit(log, task.offset + newline + 1)) {
+      return false;
+    }
+    pos = newline + 1;
+  }
+  return true;
+}
+
+template <typename Emit>
+bool scanBlock(const ScanTask& task, const ScanFilter& filter, Emit&& emit) {
+  const QueryParams& params = filter.params;
+
+  auto selected = selectRecords(*task.block, params);
+  if (!selected) {
+    return scanRange(task, filter, emit);
+  }
+
+  LogRecordView log;
+  for (uint32_t relative : *selected) {
+    if (relative >= task.bytes.size()) {
+      break;
+    }
+    size_t newline = task.bytes.find('\n', relative);
+    if (newline == std::string_view::npos) {
+      break;
+    }
+    if (matchLine(task.bytes.substr(relative, newline - relative), filter, log) && !emit(log, task.offset + newline + 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Column blocks have no per-record byte offsets, so record i of a block at
+// offset o resumes at o + i + 1 (blocks are always larger than their record
+// count) and the last record resumes at the next block.
+template <typename Emit>
+bool scanColumnBlock(BlockDecoder& decoder, std::string_view bytes, uint64_t offset, const BlockEntry* entry, const ScanTask& task, const ScanFilter& filter, Emit&& emit) {
+  const QueryParams& params = filter.params;
+
+  if (!decoder.open(bytes)) {
+    return true;
+  }
+
+  uint64_t end = offset + decoder.size();
+  if (end <= task.resume ||
+      (params.from && decoder.maxTimestamp() < params.from.value()) ||
+      (params.to && decoder.minTimestamp() > params.to.value()) ||
+      (params.cutoff && params.cutoff->excludes(decoder.minTimestamp(), decoder.maxTimestamp())) ||
+      (params.level && !decoder.hasLevel(params.level.value()))) {
+    return true;
+  }
+
+  std::optional<uint32_t> serviceId;
+  if (params.service) {
+    serviceId = decoder.findService(params.service.value());
+    if (!serviceId) {
+      return true;
     }
+  }
+
+  std::optional<std::vector<uint32_t>> selected;
+  if (entry) {
+    selected = selectRecords(*entry, params);
+  }
+  if ((selected && selected->empty()) || !decoder.decodeColumns()) {
+    return true;
+  }
+
+  // Filter on the decoded columns before inflating any message
+  size_t first = task.resume > offset ? task.resume - offset : 0;
+  std::vector<uint32_t> matches;
+  auto consider = [&](uint32_t i) {
+    if (i < first || i >= decoder.count()) return;
+    if (params.from && decoder.timestamp(i) < params.from.value()) return;
+    if (params.to && decoder.timestamp(i) > params.to.value()) return;
+    if (params.level && decoder.level(i) != params.level.value()) return;
+    if (serviceId && decoder.serviceId(i) != *serviceId) return;
+    matches.push_back(i);
+  };
+  if (selected) {
+    for (uint32_t i : *selected) consider(i);
+  } else {
+    for (uint32_t i = 0; i < decoder.count(); ++i) consider(i);
+  }
 
-    if (params.to && params.to.value() < timestamp) {
+  if (matches.empty() || !decoder.decodeMessages()) {
+    return true;
+  }
+
+  for (uint32_t i : matches) {
+    if (filter.text.active() && !filter.text.matches(decoder.message(i))) {
       continue;
     }
+    LogRecordView log {
+      decoder.timestamp(i),
+      decoder.service(decoder.serviceId(i)),
+      decoder.level(i),
+      decoder.message(i)
+    };
+    uint64_t next = i + 1 < decoder.count() ? offset + i + 1 : end;
+    if (!emit(log, next)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Emit>
+bool scanColumnBlocks(const ScanTask& task, const ScanFilter& filter, Emit&& emit) {
+  BlockDecoder decoder;
+  if (task.block) {
+    return scanColumnBlock(decoder, task.bytes, task.offset, task.block, task, filter, emit);
+  }
+
+  // Unindexed tail: walk the self-delimiting block headers
+  size_t pos = 0;
+  while (pos < task.bytes.size() && decoder.open(task.bytes.substr(pos))) {
+    size_t size = decoder.size();
+    if (!scanColumnBlock(decoder, task.bytes.substr(pos), task.offset + pos, nullptr, task, filter, emit)) {
+      return false;
+    }
+    pos += size;
+  }
+  return true;
+}
+
+template <typename Emit>
+bool runTask(const ScanTask& task, const ScanFilter& filter, Emit&& emit) {
+  const auto& cutoff = filter.params.cutoff;
+  if (task.block && cutoff && cutoff->excludes(task.block->minTimestamp, task.block->maxTimestamp)) {
+    return true;
+  }
+  if (task.format == StorageFormat::Block) {
+    return scanColumnBlocks(task, filter, emit);
+  }
+  return task.block ? scanBlock(task, filter, emit) : scanRange(task, filter, emit);
+}
+
+std::optional<QueryCursor> scanSequential(const std::vector<ScanTask>& tasks, const ScanFilter& filter, const PositionedVisitor& visit) {
+  for (const auto& task : tasks) {
+    std::optional<QueryCursor> resume;
+    runTask(task, filter, [&](const LogRecordView& log, uint64_t next) {
+      if (!visit(log, task.segment, next)) {
+        resume = QueryCursor{0, task.segment, next};
+        return false;
+      }
+      return true;
+    });
+    if (resume) {
+      return resume;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<QueryCursor> scanParallel(ThreadPool& pool, uint64_t chunkBytes, const std::vector<ScanTask>& tasks, const ScanFilter& filter, const PositionedVisitor& visit) {
+  chunkBytes = std::max<uint64_t>(chunkBytes, 1);
+
+  // Group small tasks and split large unindexed ranges at line boundaries so
+  // every chunk is roughly `target` bytes. With a cutoff, chunks start small
+  // and double up to `chunkBytes`, so the first matches can publish a cutoff
+  // before whole chunks go by unpruned.
+  uint64_t target = filter.params.cutoff ? std::max<uint64_t>(chunkBytes / 64, 1) : chunkBytes;
+  std::vector<std::vector<ScanTask>> chunks(1);
+  uint64_t currentBytes = 0;
+  auto closeChunk = [&] {
+    if (!chunks.back().empty()) {
+      chunks.emplace_back();
+      currentBytes = 0;
+      target = std::min(target * 2, chunkBytes);
+    }
+  };
 
-    if (params.service && params.service.value() != service) {
+  for (const auto& task : tasks) {
+    if (task.block || task.format == StorageFormat::Block || task.bytes.size() <= target) {
+      chunks.back().push_back(task);
+      currentBytes += task.bytes.size();
+      if (currentBytes >= target) {
+        closeChunk();
+      }
       continue;
     }
 
-    LogRecord log {
-      timestamp,
-      service,
-      level,
-      message
-    };
+    closeChunk();
+    size_t pos = 0;
+    while (pos < task.bytes.size()) {
+      size_t end = task.bytes.find('\n', std::min<size_t>(pos + target, task.bytes.size()) - 1);
+      end = end == std::string_view::npos ? task.bytes.size() : end + 1;
+      chunks.back().push_back({task.bytes.substr(pos, end - pos), nullptr, task.segment, task.offset + pos, task.format, 0});
+      closeChunk();
+      pos = end;
+    }
+  }
+  if (chunks.back().empty()) {
+    chunks.pop_back();
+  }
+
+  struct Match {
+    LogRecordView record;
+    uint64_t segment;
+    uint64_t next;
+  };
+
+  struct ChunkMatches {
+    std::vector<Match> matches;
+    Arena arena;                                            // Inflated messages the views point into
+  };
+
+  // Only a window of chunks is in flight, so a slow consumer bounds how many
+  // buffered matches a query can hold. With a cutoff the window too starts at
+  // one chunk and doubles as chunks drain.
+  std::atomic<bool> stopped{false};
+  std::deque<std::future<ChunkMatches>> pending;
+  size_t maxWindow = pool.size() * 2;
+  size_t window = filter.params.cutoff ? 1 : maxWindow;
+  size_t submitted = 0;
+
+  auto submitMore = [&] {
+    while (pending.size() < window && submitted < chunks.size()) {
+      pending.push_back(pool.submit([&filter, &stopped, chunk = std::move(chunks[submitted++])] {
+        ChunkMatches result;
+        for (const auto& task : chunk) {
+          if (stopped.load(std::memory_order_relaxed)) {
+            break;
+          }
+          // Text records and block service names point into the mapped
+          // segment, but block messages live in the decoder's buffers and
+          // unescaped text messages in a per-thread one
+          runTask(task, filter, [&](const LogRecordView& log, uint64_t next) {
+            LogRecordView stored = log;
+            if (task.format == StorageFormat::Block || !within(task.bytes, log.message)) {
+              stored.message = result.arena.store(log.message);
+            }
+            result.matches.push_back({stored, task.segment, next});
+            return true;
+          });
+        }
+        return result;
+      }));
+    }
+  };
+
+  // Futures are drained in submission order, so output stays in file order.
+  // Every future is waited on, even after stopping, since tasks borrow `filter`.
+  std::optional<QueryCursor> resume;
+  submitMore();
+  while (!pending.empty()) {
+    auto chunk = pending.front().get();
+    pending.pop_front();
+
+    for (const auto& match : chunk.matches) {
+      if (resume) {
+        break;
+      }
+      if (!visit(match.record, match.segment, match.next)) {
+        resume = QueryCursor{0, match.segment, match.next};
+        stopped.store(true, std::memory_order_relaxed);
+      }
+    }
+
+    if (!resume) {
+      window = std::min(window * 2, maxWindow);
+      submitMore();
+    }
+  }
+  return resume;
+}
+
+}
+
+FileSource::FileSource(const std::string& directory, FileSourceOptions options, std::shared_ptr<ThreadPool> pool)
+  : directory_(directory), options_(options), pool_(std::move(pool)) {
+  if (!std::filesystem::is_directory(directory_)) {
+    throw HttpError(500, "Failed to open log directory");
+  }
+  if (!pool_ && options_.scanThreads != 1) {
+    pool_ = std::make_shared<ThreadPool>(options_.scanThreads);
+  }
+  if (options_.resultCacheBytes > 0) {
+    results_ = std::make_unique<ResultCache>(options_.resultCacheBytes, options_.resultCacheEntries);
+  }
+}
+
+FileSource::~FileSource() = default;
+
+std::string FileSource::name() const {
+  return "FileSource";
+}
+
+FileSource::Snapshot FileSource::snapshot(const SegmentInfo& segment) {
+  uint64_t sidecarSize = fileSize(segment.indexPath);
+  uint64_t dataSize = fileSize(segment.dataPath);
+
+  std::lock_guard<std::mutex> lock(cacheMutex_);
+
+  auto& cached = cache_[segment.dataPath];
+  if (!cached.index || cached.index->sidecarBytes < sidecarSize) {
+    auto updated = cached.index ? std::make_shared<SegmentIndex>(*cached.index) : std::make_shared<SegmentIndex>();
+    updated->refresh(segment.indexPath);
+    cached.index = std::move(updated);
+  }
+  if (!cached.data || cached.data->size() < dataSize) {
+    if (auto remapped = MappedFile::open(segment.dataPath)) {
+      cached.data = std::move(remapped);
+    }
+  }
+  return cached;
+}
+
+void FileSource::dropStale(const std::vector<SegmentInfo>& segments) {
+  std::unordered_set<std::string> live;
+  for (const auto& segment : segments) {
+    live.insert(segment.dataPath);
+  }
+
+  std::lock_guard<std::mutex> lock(cacheMutex_);
+  for (auto it = cache_.begin(); it != cache_.end();) {
+    it = live.count(it->first) ? std::next(it) : cache_.erase(it);
+  }
+}
 
-    logs.push_back(std::move(log));
+void FileSource::checkCursor(const QueryCursor& cursor) {
+  resumePoint(cursor, listSegments(directory_));
+}
+
+std::optional<QueryCursor> FileSource::scan(const QueryParams& params, const RecordVisitor& visit) {
+  auto segments = listSegments(directory_);
+  dropStale(segments);
+
+  // An ordered query with a limit skips blocks as it goes, so what it sees
+  // is not the whole result the cache would need
+  if (!results_ || params.cutoff) {
+    return scanSegments(params, segments, [&](const LogRecordView& log, uint64_t, uint64_t) {
+      return visit(log);
+    }, nullptr);
+  }
+  return scanCached(params, segments, visit);
+}
+
+// Replays what the cache has for the query, then scans only what was
+// appended after it, extending the entry with the new matches
+std::optional<QueryCursor> FileSource::scanCached(const QueryParams& params, std::vector<SegmentInfo>& segments, const RecordVisitor& visit) {
+  auto sequencesOf = [](const std::vector<SegmentInfo>& listed) {
+    std::vector<uint64_t> sequences;
+    for (const auto& segment : listed) {
+      sequences.push_back(segment.sequence);
+    }
+    return sequences;
+  };
+  std::vector<uint64_t> sequences = sequencesOf(segments);
+  std::optional<QueryCursor> cursor = resumePoint(params.cursor, segments);
+
+  std::string key = ResultCache::key(params);
+  auto cached = results_->find(key);
+  if (cached && !cached->validFor(sequences)) {
+    results_->erase(key);                                     // Segments were removed or rewritten
+    cached.reset();
+  }
+  (cached ? metrics().cacheHits : metrics().cacheMisses).add();
+
+  auto before = [](const QueryCursor& a, const QueryCursor& b) {
+    return std::tie(a.segment, a.offset) < std::tie(b.segment, b.offset);
+  };
+
+  QueryParams live = params;
+  live.cursor = cursor;
+  bool extend = !cursor;
+  if (cached) {
+    for (size_t i = cursor ? cached->seek(*cursor) : 0; i < cached->size(); ++i) {
+      const CachedRecord& match = cached->at(i);
+      const LogRecord& log = match.record;
+      if (!visit(LogRecordView{log.timestamp, log.service, log.level, log.message})) {
+        QueryCursor resume{0, match.segment, match.next};
+        stampCursor(resume, segments);
+        return resume;
+      }
+    }
+
+    // A cursor past the cached part leaves a gap, so that scan cannot extend it
+    if (!cursor || !before(cached->watermark(), *cursor)) {
+      live.cursor = cached->watermark();
+      extend = true;
+    }
+  }
+
+  std::vector<CachedRecord> added;
+  size_t bytes = cached ? cached->bytes() : 0;
+  QueryCursor scanned;
+
+  auto resume = scanSegments(live, segments, [&](const LogRecordView& log, uint64_t segment, uint64_t next) {
+    if (extend) {
+      bytes += sizeof(CachedRecord) + log.service.size() + log.message.size();
+      if (bytes > results_->maxEntryBytes()) {
+        extend = false;                                     // Too big to be worth caching
+        added.clear();
+      } else {
+        added.push_back({toRecord(log), segment, next});
+      }
+    }
+    return visit(log);
+  }, &scanned);
+
+  if (extend && sequencesOf(segments) != sequences) {
+    extend = false;                                         // Relisted while planning
+  }
+  if (extend) {
+    QueryCursor watermark = resume ? *resume : scanned;
+    auto base = cached ? cached : std::make_shared<const CachedScan>();
+    if (!cached || !added.empty() || before(base->watermark(), watermark)) {
+      results_->store(key, cached, base->extend(std::move(added), watermark, sequences));
+    }
+  }
+  return resume;
+}
+
+// `scanned`, if set, receives the position a complete scan reached: the end
+// of the last whole record in the newest segment. A segment that is gone by
+// the time it is mapped was compacted or expired, so `segments` is listed
+// again and the scan replanned.
+std::optional<QueryCursor> FileSource::scanSegments(const QueryParams& params, std::vector<SegmentInfo>& segments, const PositionedVisitor& visit, QueryCursor* scanned) {
+  int64_t from = params.from.value_or(std::numeric_limits<int64_t>::min());
+  int64_t to = params.to.value_or(std::numeric_limits<int64_t>::max());
+
+  ScanFilter filter{params, predicateOf(params), TextMatcher(params), {}};
+  if (params.contains) {
+    filter.trigrams = trigramsOf(params.contains.value());
   }
 
-  return logs;
+  std::vector<Snapshot> snapshots;                          // Keeps task bytes and blocks alive
+  std::vector<ScanTask> tasks;
+  uint64_t scanBytes = 0;
+
+  // Maps the segments and splits them into tasks. False if one of them was
+  // removed since `segments` was listed.
+  auto plan = [&]() {
+    std::optional<QueryCursor> cursor = resumePoint(params.cursor, segments);
+
+    snapshots.clear();
+    tasks.clear();
+    scanBytes = 0;
+    bool complete = true;
+
+    for (const auto& segment : segments) {
+      if (cursor && segment.sequence < cursor->segment) {
+        continue;
+      }
+      uint64_t start = cursor && segment.sequence == cursor->segment ? cursor->offset : 0;
+
+      Snapshot snap = snapshot(segment);
+      if (!snap.data) {
+        complete = false;                                   // Removed since listing
+        continue;
+      }
+
+      std::string_view bytes = snap.data->bytes();
+      uint64_t indexed = std::min<uint64_t>(snap.index->indexedBytes(), bytes.size());
+
+      bool columns = segment.format == StorageFormat::Block;
+
+      if (snap.index->overlaps(from, to)) {
+        for (const auto& block : snap.index->blocks) {
+          uint64_t end = block.offset + block.length;
+          if (end > indexed) {
+            break;
+          }
+          if (end <= start || !block.overlaps(from, to) || !block.mayContain(filter.trigrams)) {
+            continue;
+          }
+          if (block.offset < start && !columns) {
+            tasks.push_back({bytes.substr(start, end - start), nullptr, segment.sequence, start, segment.format, 0});      // Resuming mid-block
+          } else {
+            tasks.push_back({bytes.substr(block.offset, block.length), &block, segment.sequence, block.offset, segment.format, start});
+          }
+          scanBytes += tasks.back().bytes.size();
+        }
+      }
+
+      // Bytes written after the last sidecar entry carry no timestamps yet.
+      // Column blocks can only be walked from a block boundary.
+      uint64_t tail = columns ? indexed : std::max(indexed, start);
+      if (tail < bytes.size()) {
+        tasks.push_back({bytes.substr(tail), nullptr, segment.sequence, tail, segment.format, start});
+        scanBytes += bytes.size() - tail;
+      }
+
+      if (scanned) {
+        *scanned = QueryCursor{0, segment.sequence, std::max(start, wholeRecordsEnd(bytes, indexed, segment.format))};
+      }
+
+      snapshots.push_back(std::move(snap));
+    }
+    return complete;
+  };
+
+  for (int attempt = 1; ; ++attempt) {
+    if (plan() || attempt == kPlanAttempts) {
+      break;
+    }
+    metrics().replanned.add();
+    segments = listSegments(directory_);
+    dropStale(segments);
+  }
+  metrics().scannedBytes.add(scanBytes);
+  metrics().segments.add(snapshots.size());
+
+  // Newest blocks first, so the cutoff tightens before the older ones
+  if (params.cutoff && params.order == SortOrder::Desc) {
+    std::reverse(tasks.begin(), tasks.end());
+  }
+
+  std::optional<QueryCursor> resume;
+  if (pool_ && scanBytes >= options_.parallelScanThreshold) {
+    resume = scanParallel(*pool_, options_.scanChunkBytes, tasks, filter, visit);
+  } else {
+    resume = scanSequential(tasks, filter, visit);
+  }
+
+  if (resume) {
+    stampCursor(*resume, segments);
+  }
+  if (scanned) {
+    stampCursor(*scanned, segments);
+  }
+  return resume;
 }
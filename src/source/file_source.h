@@ -1,19 +1,65 @@
 #pragma once
 
 #include "source.h"
+#include "result_cache.h"
 #include "../logging/log_record.h"
 #include "../querying/query_params.h"
-#include <fstream>
+#include "../concurrency/thread_pool.h"
+#include "../storage/mapped_file.h"
+#include "../storage/segment_directory.h"
+#include "../storage/segment_index.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
+struct FileSourceOptions {
+  size_t scanThreads = 0;                                   // Scan workers; 0 = one per hardware thread, 1 = never parallel
+  uint64_t parallelScanThreshold = 16 * 1024 * 1024;        // Queries touching at least this many bytes scan in parallel
+  uint64_t scanChunkBytes = 4 * 1024 * 1024;                // Work unit handed to one scan worker
+  size_t resultCacheBytes = 64 * 1024 * 1024;               // Cached query results; 0 disables the cache
+  size_t resultCacheEntries = 256;
+};
+
+// Reads segments through shared, immutable memory mappings. Each query takes
+// its own snapshot of a segment's mapping and index and walks it with its own
+// cursor, so concurrent queries never share stream state.
 class FileSource : public Source {
 public:
-  explicit FileSource(const std::string& path);
+  // `pool`, if given, runs the parallel scans instead of a pool of the
+  // source's own, so several sources (e.g. one per shard) can share one
+  explicit FileSource(const std::string& directory, FileSourceOptions options = {}, std::shared_ptr<ThreadPool> pool = nullptr);
   ~FileSource() override;
 
   std::string name() const override;
 
-  std::vector<LogRecord> query(const QueryParams& params) override;
+  std::optional<QueryCursor> scan(const QueryParams& params, const RecordVisitor& visit) override;
+  void checkCursor(const QueryCursor& cursor) override;
+
+  using PositionedVisitor = std::function<bool(const LogRecordView& record, uint64_t segment, uint64_t next)>;
 
 private:
-  std::ifstream file_;
+  struct Snapshot {
+    std::shared_ptr<const SegmentIndex> index;
+    std::shared_ptr<const MappedFile> data;
+  };
+
+  Snapshot snapshot(const SegmentInfo& segment);
+  void dropStale(const std::vector<SegmentInfo>& segments);
+  std::optional<QueryCursor> scanCached(const QueryParams& params, std::vector<SegmentInfo>& segments, const RecordVisitor& visit);
+  std::optional<QueryCursor> scanSegments(const QueryParams& params, std::vector<SegmentInfo>& segments, const PositionedVisitor& visit, QueryCursor* scanned);
+
+  std::string directory_;
+  FileSourceOptions options_;
+  std::shared_ptr<ThreadPool> pool_;                        // Null when parallel scans are disabled
+  std::unique_ptr<ResultCache> results_;                    // Null when result caching is disabled
+
+  // Sidecars are append-only, so cached indexes are extended rather than
+  // reloaded; data files are remapped once they have grown. Published
+  // snapshots are immutable and shared across queries. Keyed by data path,
+  // since a compacted segment takes over the sequence of its last input.
+  std::mutex cacheMutex_;
+  std::unordered_map<std::string, Snapshot> cache_;
 };
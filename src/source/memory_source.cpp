@@ -0,0 +1,217 @@
+#include "memory_source.h"
+#include "../querying/text_match.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+constexpr size_t kChunkRecords = 4096;
+constexpr size_t kChunkBytes = 256 * 1024;                  // Message bytes; larger messages get a chunk of their own
+
+}
+
+// Fixed-capacity columns. Only the writer appends; readers see records below
+// `count`, whose columns are complete by the time it is published.
+struct MemorySource::Chunk {
+  Chunk(uint64_t first, size_t records, size_t bytes)
+    : first(first),
+      capacity(records),
+      byteCapacity(bytes),
+      timestamps(new int64_t[records]),
+      services(new ServiceId[records]),
+      levels(new uint8_t[records]),
+      ends(new uint32_t[records]),
+      messages(new char[bytes]),
+      minTimestamp(std::numeric_limits<int64_t>::max()),
+      maxTimestamp(std::numeric_limits<int64_t>::min()),
+      count(0) {}
+
+  size_t memory() const {
+    return capacity * (sizeof(int64_t) + sizeof(ServiceId) + sizeof(uint8_t) + sizeof(uint32_t)) + byteCapacity;
+  }
+
+  std::string_view message(size_t i) const {
+    uint32_t begin = i == 0 ? 0 : ends[i - 1];
+    return std::string_view(messages.get() + begin, ends[i] - begin);
+  }
+
+  const uint64_t first;                                     // Ordinal of record 0
+  const size_t capacity;
+  const size_t byteCapacity;
+  std::unique_ptr<int64_t[]> timestamps;
+  std::unique_ptr<ServiceId[]> services;
+  std::unique_ptr<uint8_t[]> levels;
+  std::unique_ptr<uint32_t[]> ends;                         // Message end offsets into `messages`
+  std::unique_ptr<char[]> messages;
+  size_t used = 0;                                          // Writer-only: message bytes
+
+  std::atomic<int64_t> minTimestamp;
+  std::atomic<int64_t> maxTimestamp;
+  std::atomic<size_t> count;
+};
+
+MemorySource::MemorySource(MemorySourceOptions options)
+  : options_(options),
+    newest_(std::numeric_limits<int64_t>::min()),
+    coveredFrom_(std::numeric_limits<int64_t>::min()),
+    records_(0),
+    bytes_(0) {}
+
+std::string MemorySource::name() const {
+  return "MemorySource";
+}
+
+bool MemorySource::write(const LogRecord& record) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  append(record.timestamp, serviceIdOf(record), record.level, record.message);
+  evict();
+  return true;
+}
+
+size_t MemorySource::writeBatch(const std::vector<LogRecord>& records) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& record : records) {
+    append(record.timestamp, serviceIdOf(record), record.level, record.message);
+  }
+  evict();
+  return records.size();
+}
+
+void MemorySource::add(const LogRecordView& record) {
+  ServiceId service = ServiceTable::global().intern(record.service);
+  std::lock_guard<std::mutex> lock(mutex_);
+  append(record.timestamp, service, record.level, record.message);
+  evict();
+}
+
+void MemorySource::markCoveredFrom(int64_t timestamp) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  coveredFrom_ = std::max(coveredFrom_, timestamp);
+}
+
+void MemorySource::append(int64_t timestamp, ServiceId service, LogLevel level, std::string_view message) {
+  Chunk* chunk = chunks_.empty() ? nullptr : chunks_.back().get();
+  size_t count = chunk ? chunk->count.load(std::memory_order_relaxed) : 0;
+
+  if (!chunk || count == chunk->capacity || chunk->used + message.size() > chunk->byteCapacity) {
+    chunks_.push_back(std::make_shared<Chunk>(nextOrdinal_, kChunkRecords, std::max(kChunkBytes, message.size())));
+    chunk = chunks_.back().get();
+    count = 0;
+    bytes_.fetch_add(chunk->memory(), std::memory_order_relaxed);
+  }
+
+  std::memcpy(chunk->messages.get() + chunk->used, message.data(), message.size());
+  chunk->used += message.size();
+  chunk->timestamps[count] = timestamp;
+  chunk->services[count] = service;
+  chunk->levels[count] = static_cast<uint8_t>(level);
+  chunk->ends[count] = static_cast<uint32_t>(chunk->used);
+  if (timestamp < chunk->minTimestamp.load(std::memory_order_relaxed)) {
+    chunk->minTimestamp.store(timestamp, std::memory_order_relaxed);
+  }
+  if (timestamp > chunk->maxTimestamp.load(std::memory_order_relaxed)) {
+    chunk->maxTimestamp.store(timestamp, std::memory_order_relaxed);
+  }
+  chunk->count.store(count + 1, std::memory_order_release);
+
+  ++nextOrdinal_;
+  newest_ = std::max(newest_, timestamp);
+  records_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MemorySource::evict() {
+  auto expired = [&](const Chunk& chunk) {
+    if (bytes_.load(std::memory_order_relaxed) > options_.maxBytes) {
+      return true;
+    }
+    return options_.window.count() > 0 &&
+      chunk.maxTimestamp.load(std::memory_order_relaxed) < newest_ - options_.window.count();
+  };
+
+  // The chunk being filled is never evicted
+  while (chunks_.size() > 1 && expired(*chunks_.front())) {
+    const Chunk& oldest = *chunks_.front();
+    int64_t maxTimestamp = oldest.maxTimestamp.load(std::memory_order_relaxed);
+    if (maxTimestamp != std::numeric_limits<int64_t>::max()) {
+      coveredFrom_ = std::max(coveredFrom_, maxTimestamp + 1);
+    }
+    bytes_.fetch_sub(oldest.memory(), std::memory_order_relaxed);
+    records_.fetch_sub(oldest.count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    chunks_.pop_front();                                    // Scans still holding it keep it alive
+  }
+}
+
+MemorySource::Snapshot MemorySource::snapshot() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return Snapshot{{chunks_.begin(), chunks_.end()}, coveredFrom_};
+}
+
+std::optional<QueryCursor> MemorySource::scan(const QueryParams& params, const RecordVisitor& visit) {
+  return scan(snapshot(), params, visit);
+}
+
+std::optional<QueryCursor> MemorySource::scan(const Snapshot& snapshot, const QueryParams& params, const RecordVisitor& visit) const {
+  std::optional<ServiceId> service;
+  if (params.service) {
+    service = ServiceTable::global().find(params.service.value());
+    if (!service) {
+      return std::nullopt;                                  // Never ingested
+    }
+  }
+  TextMatcher text(params);
+  uint64_t start = params.cursor ? params.cursor->offset : 0;
+
+  // Ordered queries with a limit go newest chunk first when descending, so
+  // the cutoff tightens before the older chunks
+  bool reverse = params.cutoff && params.order == SortOrder::Desc;
+  size_t chunks = snapshot.chunks.size();
+
+  for (size_t c = 0; c < chunks; ++c) {
+    const auto& chunk = snapshot.chunks[reverse ? chunks - 1 - c : c];
+    size_t count = chunk->count.load(std::memory_order_acquire);
+    int64_t minTimestamp = chunk->minTimestamp.load(std::memory_order_relaxed);
+    int64_t maxTimestamp = chunk->maxTimestamp.load(std::memory_order_relaxed);
+    if (chunk->first + count <= start ||
+        (params.from && maxTimestamp < params.from.value()) ||
+        (params.to && minTimestamp > params.to.value()) ||
+        (params.cutoff && params.cutoff->excludes(minTimestamp, maxTimestamp))) {
+      continue;
+    }
+
+    size_t i = start > chunk->first ? start - chunk->first : 0;
+    for (; i < count; ++i) {
+      int64_t timestamp = chunk->timestamps[i];
+      if ((params.from && timestamp < params.from.value()) ||
+          (params.to && timestamp > params.to.value()) ||
+          (service && chunk->services[i] != service.value()) ||
+          (params.level && chunk->levels[i] != static_cast<uint8_t>(params.level.value()))) {
+        continue;
+      }
+
+      std::string_view message = chunk->message(i);
+      if (text.active() && !text.matches(message)) {
+        continue;
+      }
+
+      LogRecordView record{timestamp, ServiceTable::global().name(chunk->services[i]), static_cast<LogLevel>(chunk->levels[i]), message};
+      if (!visit(record)) {
+        return QueryCursor{0, 0, chunk->first + i + 1};
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+int64_t MemorySource::coveredFrom() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return coveredFrom_;
+}
+
+uint64_t MemorySource::records() const {
+  return records_.load(std::memory_order_relaxed);
+}
+
+uint64_t MemorySource::bytes() const {
+  return bytes_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "source.h"
+#include "../logging/log_record.h"
+#include "../querying/query_params.h"
+#include "../sink/sink.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct MemorySourceOptions {
+  uint64_t maxBytes = 64 * 1024 * 1024;                     // Memory held by the window
+  std::chrono::seconds window{900};                         // Drop records this much older than the newest one; 0 = no limit
+};
+
+// The hot tier: the most recent records, fed by the FileSink as it queues
+// them and kept in columnar chunks in memory. Every record with a timestamp at or after
+// coveredFrom() is guaranteed to be here, so the Querier can answer that part
+// of a query without going to disk, including records the FileSink has not
+// written yet.
+//
+// Chunks are append-only and published with a release store of their record
+// count, so scans read them without locking out ingestion.
+class MemorySource : public Source, public Sink {
+public:
+  explicit MemorySource(MemorySourceOptions options = {});
+
+  std::string name() const override;
+
+  bool write(const LogRecord& record) override;
+  size_t writeBatch(const std::vector<LogRecord>& records) override;
+  void add(const LogRecordView& record);                    // For warming up from disk
+
+  // Records before `timestamp` were never added, e.g. because warm-up only
+  // read the recent window, so coverage cannot start earlier
+  void markCoveredFrom(int64_t timestamp);
+
+  struct Chunk;
+
+  // The chunks to scan and the coverage they guarantee, taken together so
+  // an eviction cannot slip between deciding what to read from memory and
+  // reading it. Chunks keep filling after the snapshot is taken.
+  struct Snapshot {
+    std::vector<std::shared_ptr<const Chunk>> chunks;
+    int64_t coveredFrom;
+  };
+
+  Snapshot snapshot();
+
+  // Cursors are {0, 0, ordinal of the next record}
+  std::optional<QueryCursor> scan(const QueryParams& params, const RecordVisitor& visit) override;
+  std::optional<QueryCursor> scan(const Snapshot& snapshot, const QueryParams& params, const RecordVisitor& visit) const;
+
+  int64_t coveredFrom();
+  uint64_t records() const;
+  uint64_t bytes() const;
+
+private:
+  void append(int64_t timestamp, ServiceId service, LogLevel level, std::string_view message);
+  void evict();
+
+  MemorySourceOptions options_;
+
+  std::mutex mutex_;                                        // Serializes writers and guards the members below
+  std::deque<std::shared_ptr<Chunk>> chunks_;
+  uint64_t nextOrdinal_ = 0;
+  int64_t newest_;
+  int64_t coveredFrom_;                                     // Past the newest timestamp ever evicted
+
+  std::atomic<uint64_t> records_;
+  std::atomic<uint64_t> bytes_;
+};
@@ -0,0 +1,123 @@
+#include "result_cache.h"
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+
+size_t CachedScan::seek(const QueryCursor& cursor) const {
+  size_t low = 0;
+  size_t high = count_;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    const CachedRecord& record = at(middle);
+    if (std::tie(record.segment, record.next) <= std::tie(cursor.segment, cursor.offset)) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+bool CachedScan::validFor(const std::vector<uint64_t>& sequences) const {
+  auto end = std::upper_bound(sequences.begin(), sequences.end(), watermark_.segment);
+  return std::equal(sequences.begin(), end, segments_.begin(), segments_.end());
+}
+
+std::shared_ptr<const CachedScan> CachedScan::extend(std::vector<CachedRecord>&& records, const QueryCursor& watermark, const std::vector<uint64_t>& sequences) const {
+  auto extended = std::make_shared<CachedScan>(*this);
+  extended->watermark_ = watermark;
+  extended->segments_.assign(sequences.begin(), std::upper_bound(sequences.begin(), sequences.end(), watermark.segment));
+
+  // The last chunk may be partly filled, so it is copied before appending
+  std::vector<CachedRecord> open;
+  if (count_ % kChunkRecords != 0) {
+    open = *extended->chunks_.back();
+    extended->chunks_.pop_back();
+  }
+  for (auto& record : records) {
+    extended->bytes_ += sizeof(CachedRecord) + record.record.service.size() + record.record.message.size();
+    open.push_back(std::move(record));
+    if (open.size() == kChunkRecords) {
+      extended->chunks_.push_back(std::make_shared<const std::vector<CachedRecord>>(std::move(open)));
+      open.clear();
+    }
+  }
+  if (!open.empty()) {
+    extended->chunks_.push_back(std::make_shared<const std::vector<CachedRecord>>(std::move(open)));
+  }
+  extended->count_ += records.size();
+  return extended;
+}
+
+ResultCache::ResultCache(size_t maxBytes, size_t maxEntries)
+  : maxBytes_(maxBytes), maxEntries_(std::max<size_t>(maxEntries, 1)) {}
+
+std::string ResultCache::key(const QueryParams& params) {
+  std::string key;
+  auto field = [&key](char name, const auto& value) {
+    if (!value) {
+      return;
+    }
+    key += name;
+    if constexpr (std::is_same_v<std::decay_t<decltype(*value)>, std::string>) {
+      key += std::to_string(value->size()) + ':' + *value;  // Length-prefixed, so no value can fake a separator
+    } else {
+      key += std::to_string(static_cast<int64_t>(*value));
+    }
+    key += ';';
+  };
+  field('l', params.level);
+  field('s', params.service);
+  field('f', params.from);
+  field('t', params.to);
+  field('q', params.contains);
+  field('r', params.regex);
+  return key;
+}
+
+std::shared_ptr<const CachedScan> ResultCache::find(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return nullptr;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+void ResultCache::store(const std::string& key, const std::shared_ptr<const CachedScan>& previous, std::shared_ptr<const CachedScan> scan) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    if (it->second->second != previous) {
+      return;                                               // Lost the race to another query extending it
+    }
+    bytes_ -= it->second->second->bytes();
+    lru_.erase(it->second);
+    entries_.erase(it);
+  }
+
+  bytes_ += scan->bytes();
+  lru_.emplace_front(key, std::move(scan));
+  entries_[key] = lru_.begin();
+
+  while (!lru_.empty() && (bytes_ > maxBytes_ || entries_.size() > maxEntries_)) {
+    bytes_ -= lru_.back().second->bytes();
+    entries_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+}
+
+void ResultCache::erase(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    bytes_ -= it->second->second->bytes();
+    lru_.erase(it->second);
+    entries_.erase(it);
+  }
+}
+
+size_t ResultCache::maxEntryBytes() const {
+  return maxBytes_ / 4;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "../logging/log_record.h"
+#include "../querying/query_params.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A match remembered together with where a scan resumes after it
+struct CachedRecord {
+  LogRecord record;
+  uint64_t segment;
+  uint64_t next;
+};
+
+// The matches of a query over a prefix of the segments, in file order, and
+// the position the scan had reached. Immutable once published; extending one
+// shares all full chunks with its predecessor.
+class CachedScan {
+public:
+  static constexpr size_t kChunkRecords = 1024;
+
+  size_t size() const { return count_; }
+  size_t bytes() const { return bytes_; }
+  const QueryCursor& watermark() const { return watermark_; }
+  const CachedRecord& at(size_t i) const { return (*chunks_[i / kChunkRecords])[i % kChunkRecords]; }
+
+  // First record positioned after `cursor`
+  size_t seek(const QueryCursor& cursor) const;
+
+  // Whether the segments this covers are still the ones on disk
+  bool validFor(const std::vector<uint64_t>& sequences) const;
+
+  // A copy extended by `records`, with the scan now at `watermark`
+  std::shared_ptr<const CachedScan> extend(std::vector<CachedRecord>&& records, const QueryCursor& watermark, const std::vector<uint64_t>& sequences) const;
+
+private:
+  std::vector<std::shared_ptr<const std::vector<CachedRecord>>> chunks_;
+  size_t count_ = 0;
+  size_t bytes_ = 0;
+  QueryCursor watermark_;
+  std::vector<uint64_t> segments_;                          // Sequences up to the watermark's segment
+};
+
+// Bounded LRU of CachedScans, keyed on the filter part of QueryParams
+class ResultCache {
+public:
+  ResultCache(size_t maxBytes, size_t maxEntries);
+
+  // Ignores `limit` and `cursor`, which only decide how much of a scan is read
+  static std::string key(const QueryParams& params);
+
+  std::shared_ptr<const CachedScan> find(const std::string& key);
+
+  // Publishes `scan` unless another query already replaced `previous`
+  void store(const std::string& key, const std::shared_ptr<const CachedScan>& previous, std::shared_ptr<const CachedScan> scan);
+  void erase(const std::string& key);
+
+  size_t maxEntryBytes() const;
+
+private:
+  using Entry = std::pair<std::string, std::shared_ptr<const CachedScan>>;
+
+  size_t maxBytes_;
+  size_t maxEntries_;
+  std::mutex mutex_;
+  std::list<Entry> lru_;                                    // Most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+  size_t bytes_ = 0;
+};
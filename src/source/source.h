@@ -2,14 +2,34 @@
 
 #include "../querying/query_params.h"
 #include "../logging/log_record.h"
+#include <functional>
+#include <optional>
 #include <string>
 #include <vector>
 
+// Receives matching records in source order; returning false stops the scan
+// after this record
+using RecordVisitor = std::function<bool(const LogRecordView& record)>;
+
 class Source {
 public:
   virtual ~Source() = default;
   
   virtual std::string name() const = 0;
 
-  virtual std::vector<LogRecord> query(const QueryParams& record) = 0;
+  // Streams matches to `visit`, resuming from `params.cursor` if set. Returns
+  // where to resume if the visitor stopped the scan early.
+  virtual std::optional<QueryCursor> scan(const QueryParams& params, const RecordVisitor& visit) = 0;
+
+  // Throws HttpError(410) if scan() could no longer resume from `cursor`
+  virtual void checkCursor(const QueryCursor&) {}
+
+  std::vector<LogRecord> query(const QueryParams& params) {
+    std::vector<LogRecord> logs;
+    scan(params, [&logs](const LogRecordView& record) {
+      logs.push_back(toRecord(record));
+      return true;
+    });
+    return logs;
+  }
 };
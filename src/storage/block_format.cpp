@@ -0,0 +1,322 @@
+#include "block_format.h"
+#include "crc32.h"
+#include "varint.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#ifdef LOGAN_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+
+constexpr char kBlockMagic[4] = {'L', 'G', 'B', '1'};
+constexpr uint8_t kCodecStored = 0;
+constexpr uint8_t kCodecDeflate = 1;
+constexpr int kLevelBits = 3;
+
+// Limits on what a header may claim, checked before anything is sized from
+// it. A payload is at most 4 GiB (its size is a u32), and deflate expands
+// data by at most about 1032:1.
+constexpr uint64_t kMaxRawMessageBytes = std::numeric_limits<uint32_t>::max();
+constexpr uint64_t kMaxDeflateRatio = 1032;
+
+void putFixed32(std::string& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+uint32_t getFixed32(const char* data) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+  }
+  return value;
+}
+
+void putColumn(std::string& out, const std::string& column) {
+  putVarint(out, column.size());
+  out += column;
+}
+
+bool getColumn(std::string_view data, size_t& pos, std::string_view& column) {
+  uint64_t size;
+  if (!getVarint(data, pos, size) || size > data.size() - pos) {
+    return false;
+  }
+  column = data.substr(pos, size);
+  pos += size;
+  return true;
+}
+
+uint8_t compressMessages(const std::string& raw, std::string& stored) {
+#ifdef LOGAN_HAVE_ZLIB
+  uLongf bound = compressBound(raw.size());
+  stored.resize(bound);
+  if (compress2(reinterpret_cast<Bytef*>(stored.data()), &bound, reinterpret_cast<const Bytef*>(raw.data()), raw.size(), Z_DEFAULT_COMPRESSION) == Z_OK &&
+      bound < raw.size()) {
+    stored.resize(bound);
+    return kCodecDeflate;
+  }
+#endif
+  stored = raw;
+  return kCodecStored;
+}
+
+}
+
+void encodeBlock(std::string& out, const LogRecord* records, size_t count) {
+  int64_t minTimestamp = std::numeric_limits<int64_t>::max();
+  int64_t maxTimestamp = std::numeric_limits<int64_t>::min();
+  uint8_t levelMask = 0;
+  std::unordered_map<std::string_view, uint32_t> dictionary;
+  std::vector<std::string_view> services;
+
+  std::string timestamps;
+  std::string serviceIds;
+  std::string levels((count * kLevelBits + 7) / 8, '\0');
+  std::string lengths;
+  std::string messages;
+
+  for (size_t i = 0; i < count; ++i) {
+    minTimestamp = std::min(minTimestamp, records[i].timestamp);
+    maxTimestamp = std::max(maxTimestamp, records[i].timestamp);
+  }
+
+  int64_t previous = minTimestamp;
+  for (size_t i = 0; i < count; ++i) {
+    const auto& record = records[i];
+
+    putSignedVarint(timestamps, record.timestamp - previous);
+    previous = record.timestamp;
+
+    auto [it, inserted] = dictionary.emplace(record.service, static_cast<uint32_t>(services.size()));
+    if (inserted) {
+      services.push_back(record.service);
+    }
+    putVarint(serviceIds, it->second);
+
+    auto level = static_cast<uint32_t>(record.level);
+    levelMask |= static_cast<uint8_t>(1u << level);
+    size_t bit = i * kLevelBits;
+    levels[bit / 8] |= static_cast<char>(level << (bit % 8));
+    if (bit % 8 > 8 - kLevelBits) {
+      levels[bit / 8 + 1] |= static_cast<char>(level >> (8 - bit % 8));
+    }
+
+    putVarint(lengths, record.message.size());
+    messages += record.message;
+  }
+
+  std::string stored;
+  uint8_t codec = compressMessages(messages, stored);
+
+  std::string payload;
+  putVarint(payload, count);
+  putSignedVarint(payload, count ? minTimestamp : 0);
+  putVarint(payload, count ? static_cast<uint64_t>(maxTimestamp - minTimestamp) : 0);
+  payload.push_back(static_cast<char>(levelMask));
+  putVarint(payload, services.size());
+  for (auto service : services) {
+    putVarint(payload, service.size());
+    payload.append(service.data(), service.size());
+  }
+  putColumn(payload, timestamps);
+  putColumn(payload, serviceIds);
+  putColumn(payload, levels);
+  putColumn(payload, lengths);
+  payload.push_back(static_cast<char>(codec));
+  putVarint(payload, messages.size());
+  putColumn(payload, stored);
+
+  out.append(kBlockMagic, sizeof(kBlockMagic));
+  putFixed32(out, static_cast<uint32_t>(payload.size()));
+  putFixed32(out, crc32(payload));
+  out += payload;
+}
+
+bool BlockDecoder::open(std::string_view bytes) {
+  services_.clear();
+
+  if (bytes.size() < kBlockHeaderSize || std::memcmp(bytes.data(), kBlockMagic, sizeof(kBlockMagic)) != 0) {
+    return false;
+  }
+  uint32_t payloadSize = getFixed32(bytes.data() + 4);
+  if (payloadSize > bytes.size() - kBlockHeaderSize) {
+    return false;                                           // Truncated
+  }
+  crc_ = getFixed32(bytes.data() + 8);
+  block_ = bytes.substr(0, kBlockHeaderSize + payloadSize);
+  payload_ = block_.substr(kBlockHeaderSize);
+
+  size_t pos = 0;
+  uint64_t count;
+  uint64_t span;
+  uint64_t serviceCount;
+  if (!getVarint(payload_, pos, count) ||
+      !getSignedVarint(payload_, pos, minTimestamp_) ||
+      !getVarint(payload_, pos, span) ||
+      pos >= payload_.size()) {
+    return false;
+  }
+  if (count > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+  count_ = static_cast<uint32_t>(count);
+  maxTimestamp_ = minTimestamp_ + static_cast<int64_t>(span);
+  levelMask_ = static_cast<uint8_t>(payload_[pos++]);
+
+  // Each service name takes at least its length byte
+  if (!getVarint(payload_, pos, serviceCount) || serviceCount > payload_.size() - pos) {
+    return false;
+  }
+  services_.resize(serviceCount);
+  for (auto& service : services_) {
+    if (!getColumn(payload_, pos, service)) {
+      return false;
+    }
+  }
+
+  if (!getColumn(payload_, pos, timestampColumn_) ||
+      !getColumn(payload_, pos, serviceColumn_) ||
+      !getColumn(payload_, pos, levelColumn_) ||
+      !getColumn(payload_, pos, lengthColumn_) ||
+      pos >= payload_.size()) {
+    return false;
+  }
+  messageCodec_ = static_cast<uint8_t>(payload_[pos++]);
+  if (!getVarint(payload_, pos, rawMessageBytes_) || !getColumn(payload_, pos, messageColumn_)) {
+    return false;
+  }
+
+  // Each record takes at least one byte in every varint column
+  if (count_ > timestampColumn_.size() ||
+      count_ > serviceColumn_.size() ||
+      count_ > lengthColumn_.size() ||
+      levelColumn_.size() < (static_cast<size_t>(count_) * kLevelBits + 7) / 8) {
+    return false;
+  }
+  return rawMessageBytes_ <= kMaxRawMessageBytes &&
+         rawMessageBytes_ <= std::max<uint64_t>(messageColumn_.size(), 1) * kMaxDeflateRatio;
+}
+
+bool BlockDecoder::verify() const {
+  return crc32(payload_) == crc_;
+}
+
+size_t BlockDecoder::size() const {
+  return block_.size();
+}
+
+uint32_t BlockDecoder::count() const {
+  return count_;
+}
+
+int64_t BlockDecoder::minTimestamp() const {
+  return minTimestamp_;
+}
+
+int64_t BlockDecoder::maxTimestamp() const {
+  return maxTimestamp_;
+}
+
+bool BlockDecoder::hasLevel(LogLevel level) const {
+  return levelMask_ & (1u << static_cast<uint32_t>(level));
+}
+
+std::optional<uint32_t> BlockDecoder::findService(std::string_view service) const {
+  auto it = std::find(services_.begin(), services_.end(), service);
+  if (it == services_.end()) {
+    return std::nullopt;
+  }
+  return static_cast<uint32_t>(it - services_.begin());
+}
+
+bool BlockDecoder::decodeColumns() {
+  timestamps_.resize(count_);
+  serviceIds_.resize(count_);
+  levels_.resize(count_);
+
+  size_t tsPos = 0;
+  size_t servicePos = 0;
+  int64_t previous = minTimestamp_;
+  for (size_t i = 0; i < count_; ++i) {
+    int64_t delta;
+    uint64_t id;
+    if (!getSignedVarint(timestampColumn_, tsPos, delta) || !getVarint(serviceColumn_, servicePos, id) || id >= services_.size()) {
+      return false;
+    }
+    previous += delta;
+    timestamps_[i] = previous;
+    serviceIds_[i] = static_cast<uint32_t>(id);
+
+    size_t bit = i * kLevelBits;
+    uint32_t bits = static_cast<uint8_t>(levelColumn_[bit / 8]);
+    if (bit / 8 + 1 < levelColumn_.size()) {
+      bits |= static_cast<uint32_t>(static_cast<uint8_t>(levelColumn_[bit / 8 + 1])) << 8;
+    }
+    uint32_t level = (bits >> (bit % 8)) & ((1u << kLevelBits) - 1);
+    if (level >= kLogLevelCount) {
+      return false;
+    }
+    levels_[i] = static_cast<LogLevel>(level);
+  }
+  return true;
+}
+
+int64_t BlockDecoder::timestamp(size_t i) const {
+  return timestamps_[i];
+}
+
+uint32_t BlockDecoder::serviceId(size_t i) const {
+  return serviceIds_[i];
+}
+
+std::string_view BlockDecoder::service(uint32_t id) const {
+  return services_[id];
+}
+
+LogLevel BlockDecoder::level(size_t i) const {
+  return levels_[i];
+}
+
+bool BlockDecoder::decodeMessages() {
+  std::string_view raw;
+  if (messageCodec_ == kCodecStored) {
+    raw = messageColumn_;
+  } else if (messageCodec_ == kCodecDeflate) {
+#ifdef LOGAN_HAVE_ZLIB
+    inflated_.resize(rawMessageBytes_);
+    uLongf size = rawMessageBytes_;
+    if (uncompress(reinterpret_cast<Bytef*>(inflated_.data()), &size, reinterpret_cast<const Bytef*>(messageColumn_.data()), messageColumn_.size()) != Z_OK ||
+        size != rawMessageBytes_) {
+      return false;
+    }
+    raw = inflated_;
+#else
+    return false;                                           // Written by a build with zlib
+#endif
+  } else {
+    return false;
+  }
+
+  messages_.resize(count_);
+  size_t lengthPos = 0;
+  size_t offset = 0;
+  for (size_t i = 0; i < count_; ++i) {
+    uint64_t length;
+    if (!getVarint(lengthColumn_, lengthPos, length) || length > raw.size() - offset) {
+      return false;
+    }
+    messages_[i] = raw.substr(offset, length);
+    offset += length;
+  }
+  return true;
+}
+
+std::string_view BlockDecoder::message(size_t i) const {
+  return messages_[i];
+}
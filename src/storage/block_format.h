@@ -0,0 +1,76 @@
+#pragma once
+
+#include "../logging/log_record.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Column-wise encoding of a batch of records, used by `.blk` segments:
+//
+//   "LGB1" | payload size (u32 LE) | payload crc32 (u32 LE) | payload
+//
+// The payload starts with a summary (record count, min/max timestamp, a
+// bitmask of levels present and the block's service dictionary), followed by
+// the columns: zigzag-varint timestamp deltas, varint dictionary ids, 3-bit
+// packed levels, varint message lengths, and the concatenated messages,
+// deflated when zlib is available.
+
+constexpr size_t kBlockHeaderSize = 12;
+
+void encodeBlock(std::string& out, const LogRecord* records, size_t count);
+
+// Decodes one block in stages so filters can run on the summary and the
+// compact columns before any message is inflated
+class BlockDecoder {
+public:
+  // `bytes` starts at a block and may run past it. False if the header is
+  // malformed, claims more records or message bytes than its columns could
+  // hold, or the block is truncated.
+  bool open(std::string_view bytes);
+
+  // Checks the payload CRC; only needed where torn writes are possible
+  bool verify() const;
+
+  size_t size() const;                                      // Encoded bytes, header included
+  uint32_t count() const;
+  int64_t minTimestamp() const;
+  int64_t maxTimestamp() const;
+  bool hasLevel(LogLevel level) const;
+  std::optional<uint32_t> findService(std::string_view service) const;
+
+  bool decodeColumns();
+  int64_t timestamp(size_t i) const;
+  uint32_t serviceId(size_t i) const;
+  std::string_view service(uint32_t id) const;
+  LogLevel level(size_t i) const;
+
+  bool decodeMessages();
+  std::string_view message(size_t i) const;
+
+private:
+  std::string_view block_;
+  std::string_view payload_;
+  uint32_t crc_ = 0;
+
+  uint32_t count_ = 0;
+  int64_t minTimestamp_ = 0;
+  int64_t maxTimestamp_ = 0;
+  uint8_t levelMask_ = 0;
+  std::vector<std::string_view> services_;
+  std::string_view timestampColumn_;
+  std::string_view serviceColumn_;
+  std::string_view levelColumn_;
+  std::string_view lengthColumn_;
+  uint8_t messageCodec_ = 0;
+  uint64_t rawMessageBytes_ = 0;
+  std::string_view messageColumn_;
+
+  std::vector<int64_t> timestamps_;
+  std::vector<uint32_t> serviceIds_;
+  std::vector<LogLevel> levels_;
+  std::string inflated_;
+  std::vector<std::string_view> messages_;
+};
@@ -0,0 +1,28 @@
+#include "crc32.h"
+#include <array>
+
+namespace {
+
+std::array<uint32_t, 256> makeTable() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t value = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      value = (value & 1) ? (value >> 1) ^ 0xEDB88320u : value >> 1;
+    }
+    table[i] = value;
+  }
+  return table;
+}
+
+}
+
+uint32_t crc32(std::string_view data, uint32_t crc) {
+  static const std::array<uint32_t, 256> table = makeTable();
+
+  crc = ~crc;
+  for (unsigned char byte : data) {
+    crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// CRC-32 (IEEE 802.3 polynomial, as used by zlib and gzip)
+uint32_t crc32(std::string_view data, uint32_t crc = 0);
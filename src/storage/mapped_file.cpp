@@ -0,0 +1,49 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(void* data, size_t size)
+  : data_(data), size_(size) {}
+
+MappedFile::~MappedFile() {
+  if (data_) {
+    munmap(data_, size_);
+  }
+}
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return nullptr;
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  void* data = nullptr;
+  if (size > 0) {
+    data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      ::close(fd);
+      return nullptr;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+  }
+  ::close(fd);                                              // The mapping keeps the file alive
+
+  return std::shared_ptr<const MappedFile>(new MappedFile(data, size));
+}
+
+std::string_view MappedFile::bytes() const {
+  return size_ ? std::string_view(static_cast<const char*>(data_), size_) : std::string_view();
+}
+
+size_t MappedFile::size() const {
+  return size_;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a file as it was when mapped. Mappings are
+// immutable, so any number of threads can read one concurrently; a file that
+// has grown is remapped rather than extended in place.
+class MappedFile {
+public:
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // nullptr if the file cannot be opened (e.g. removed since it was listed)
+  static std::shared_ptr<const MappedFile> open(const std::string& path);
+
+  std::string_view bytes() const;
+  size_t size() const;
+
+private:
+  MappedFile(void* data, size_t size);
+
+  void* data_;
+  size_t size_;
+};
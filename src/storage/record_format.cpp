@@ -0,0 +1,202 @@
+#include "record_format.h"
+#include "crc32.h"
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+constexpr char kFrameMarker = '@';
+constexpr char kEscapedFrameMarker = '&';
+
+// What std::isspace accepts in the "C" locale, without the locale lookup
+bool isSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+const char* skipSpaces(const char* pos, const char* end) {
+  while (pos < end && isSpace(*pos)) {
+    ++pos;
+  }
+  return pos;
+}
+
+struct HexTable {
+  signed char digits[256];
+  constexpr HexTable() : digits() {
+    for (int c = 0; c < 256; ++c) {
+      digits[c] = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    }
+  }
+};
+constexpr HexTable kHex;
+
+int hexDigit(char c) {
+  return kHex.digits[static_cast<unsigned char>(c)];
+}
+
+// Hex digits up to the first non-digit, which must be `terminator`
+template <typename T>
+bool parseHex(const char*& pos, const char* end, char terminator, T& value) {
+  const char* start = pos;
+  value = 0;
+  for (int digit; pos < end && (digit = hexDigit(*pos)) >= 0; ++pos) {
+    if (pos - start == 2 * static_cast<int>(sizeof(T))) {
+      return false;                                         // Overflow
+    }
+    value = static_cast<T>(value << 4 | static_cast<T>(digit));
+  }
+  return pos != start && pos < end && *pos++ == terminator;
+}
+
+// Optionally signed decimal, ending at a space or the end of the line
+bool parseTimestamp(const char*& pos, const char* end, int64_t& value) {
+  bool negative = pos < end && *pos == '-';
+  const char* digits = pos + negative;
+  uint64_t magnitude = 0;
+  const char* cursor = digits;
+  for (; cursor < end && static_cast<unsigned>(*cursor - '0') < 10; ++cursor) {
+    if (cursor - digits == 19) {
+      return false;                                         // Out of range
+    }
+    magnitude = magnitude * 10 + static_cast<unsigned>(*cursor - '0');
+  }
+  if (cursor == digits || magnitude > static_cast<uint64_t>(INT64_MAX) + negative) {
+    return false;
+  }
+  value = negative ? static_cast<int64_t>(0 - magnitude) : static_cast<int64_t>(magnitude);
+  pos = cursor;
+  return true;
+}
+
+// Splits a framed line into its payload and recorded CRC. Unframed lines come
+// back unchanged with `framed == false`.
+bool unframe(std::string_view line, std::string_view& payload, uint32_t& crc, bool& framed, bool& escaped) {
+  framed = !line.empty() && (line[0] == kFrameMarker || line[0] == kEscapedFrameMarker);
+  escaped = framed && line[0] == kEscapedFrameMarker;
+  if (!framed) {
+    payload = line;
+    return true;
+  }
+
+  const char* pos = line.data() + 1;
+  const char* end = line.data() + line.size();
+
+  uint64_t length;
+  if (!parseHex(pos, end, ',', length) || !parseHex(pos, end, ' ', crc)) {
+    return false;
+  }
+
+  payload = std::string_view(pos, end - pos);
+  return payload.size() == length;
+}
+
+ParseResult parsePayload(std::string_view line, const RecordPredicate* predicate, RecordFields& fields) {
+  const char* pos = line.data();
+  const char* end = pos + line.size();
+
+  pos = skipSpaces(pos, end);
+  if (!parseTimestamp(pos, end, fields.timestamp)) {
+    return ParseResult::Malformed;
+  }
+  if (predicate && ((predicate->from && fields.timestamp < predicate->from.value()) ||
+                    (predicate->to && fields.timestamp > predicate->to.value()))) {
+    return ParseResult::Filtered;
+  }
+
+  pos = skipSpaces(pos, end);
+  const char* serviceEnd = pos == end ? nullptr : static_cast<const char*>(std::memchr(pos, ' ', end - pos));
+  if (!serviceEnd) {
+    return ParseResult::Malformed;
+  }
+  fields.service = std::string_view(pos, serviceEnd - pos);
+  if (predicate && predicate->service && predicate->service.value() != fields.service) {
+    return ParseResult::Filtered;
+  }
+
+  pos = skipSpaces(serviceEnd, end);
+  if (pos == end || static_cast<unsigned>(*pos - '0') >= kLogLevelCount || (pos + 1 < end && static_cast<unsigned>(pos[1] - '0') < 10)) {
+    return ParseResult::Malformed;
+  }
+  fields.level = static_cast<LogLevel>(*pos - '0');
+  if (predicate && predicate->level && predicate->level.value() != fields.level) {
+    return ParseResult::Filtered;
+  }
+
+  pos = skipSpaces(pos + 1, end);
+  fields.message = std::string_view(pos, end - pos);
+  return ParseResult::Match;
+}
+
+ParseResult parseLine(std::string_view line, const RecordPredicate* predicate, RecordFields& fields) {
+  std::string_view payload;
+  uint32_t crc;
+  bool framed;
+  if (!unframe(line, payload, crc, framed, fields.escaped)) {
+    return ParseResult::Malformed;
+  }
+  return parsePayload(payload, predicate, fields);
+}
+
+}
+
+void formatRecord(std::string& out, const LogRecord& record) {
+  const std::string& message = record.message;
+  bool escape = std::memchr(message.data(), '\n', message.size()) != nullptr;
+
+  std::string payload;
+  payload.reserve(32 + record.service.size() + message.size());
+  payload += std::to_string(record.timestamp);
+  payload += ' ';
+  payload += record.service;
+  payload += ' ';
+  payload += static_cast<char>('0' + static_cast<int>(record.level));
+  payload += ' ';
+  if (!escape) {
+    payload += message;
+  } else {
+    for (char c : message) {
+      if (c == '\n') {
+        payload += "\\n";
+      } else if (c == '\\') {
+        payload += "\\\\";
+      } else {
+        payload += c;
+      }
+    }
+  }
+
+  char frame[32];
+  int frameSize = std::snprintf(frame, sizeof(frame), "%c%zx,%08x ", escape ? kEscapedFrameMarker : kFrameMarker, payload.size(), crc32(payload));
+  out.append(frame, frameSize);
+  out += payload;
+  out += '\n';
+}
+
+bool parseRecord(std::string_view line, RecordFields& fields) {
+  return parseLine(line, nullptr, fields) == ParseResult::Match;
+}
+
+ParseResult parseRecord(std::string_view line, const RecordPredicate& predicate, RecordFields& fields) {
+  return parseLine(line, &predicate, fields);
+}
+
+void unescapeMessage(std::string_view message, std::string& out) {
+  out.clear();
+  out.reserve(message.size());
+  for (size_t i = 0; i < message.size(); ++i) {
+    if (message[i] == '\\' && i + 1 < message.size()) {
+      out += message[++i] == 'n' ? '\n' : message[i];
+    } else {
+      out += message[i];
+    }
+  }
+}
+
+bool verifyRecord(std::string_view line) {
+  std::string_view payload;
+  uint32_t crc;
+  bool framed;
+  bool escaped;
+  RecordFields fields;
+  return unframe(line, payload, crc, framed, escaped) && (!framed || crc32(payload) == crc) && parsePayload(payload, nullptr, fields) == ParseResult::Match;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../logging/log_record.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// One on-disk line, viewed in place. Lines are framed as
+//   "@<length>,<crc32> <timestamp> <service> <level> <message>"
+// where length (hex) and crc32 (8 hex digits) cover the payload after the
+// space. A message containing newlines is written with `&` in place of `@`
+// and its backslashes and newlines escaped as `\\` and `\n`, so every record
+// stays on one line. Unframed lines from older segments are still readable.
+struct RecordFields {
+  int64_t timestamp;
+  std::string_view service;
+  LogLevel level;
+  std::string_view message;
+  bool escaped = false;                                     // `message` holds escape sequences; see unescapeMessage()
+};
+
+// Filters checked while a line is parsed, each as soon as its field is
+// read, so most lines that fail one are never parsed to the end
+struct RecordPredicate {
+  std::optional<int64_t> from;
+  std::optional<int64_t> to;
+  std::optional<LogLevel> level;
+  std::optional<std::string_view> service;
+};
+
+enum class ParseResult {
+  Match,
+  Filtered,                                                 // Parsed far enough to fail the predicate
+  Malformed
+};
+
+void formatRecord(std::string& out, const LogRecord& record);
+
+// `line` excludes the trailing newline. Returns false for malformed lines;
+// the frame length is checked so torn lines are rejected, but not the CRC.
+bool parseRecord(std::string_view line, RecordFields& fields);
+ParseResult parseRecord(std::string_view line, const RecordPredicate& predicate, RecordFields& fields);
+
+// The message of an escaped record as it was logged. `out` is overwritten.
+void unescapeMessage(std::string_view message, std::string& out);
+
+// Full check including the CRC, for recovery. Unframed lines pass if they parse.
+bool verifyRecord(std::string_view line);
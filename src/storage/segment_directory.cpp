@@ -0,0 +1,109 @@
+#include "segment_directory.h"
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+
+constexpr const char* kTextExtension = ".log";
+constexpr const char* kBlockExtension = ".blk";
+constexpr const char* kIndexExtension = ".idx";
+constexpr const char* kMapExtension = ".map";
+
+std::string segmentStem(const std::string& directory, uint64_t first, uint64_t last) {
+  char name[48];
+  if (first == last) {
+    std::snprintf(name, sizeof(name), "segment-%08llu", static_cast<unsigned long long>(last));
+  } else {
+    std::snprintf(name, sizeof(name), "segment-%08llu_%08llu", static_cast<unsigned long long>(first), static_cast<unsigned long long>(last));
+  }
+  return (std::filesystem::path(directory) / name).string();
+}
+
+}
+
+std::string segmentDataPath(const std::string& directory, uint64_t sequence, StorageFormat format) {
+  return segmentDataPath(directory, sequence, sequence, format);
+}
+
+std::string segmentIndexPath(const std::string& directory, uint64_t sequence) {
+  return segmentIndexPath(directory, sequence, sequence);
+}
+
+std::string segmentDataPath(const std::string& directory, uint64_t first, uint64_t last, StorageFormat format) {
+  return segmentStem(directory, first, last) + (format == StorageFormat::Block ? kBlockExtension : kTextExtension);
+}
+
+std::string segmentIndexPath(const std::string& directory, uint64_t first, uint64_t last) {
+  return segmentStem(directory, first, last) + kIndexExtension;
+}
+
+std::string segmentMapPath(const std::string& directory, uint64_t first, uint64_t last) {
+  return segmentStem(directory, first, last) + kMapExtension;
+}
+
+std::vector<SegmentInfo> listSegments(const std::string& directory, std::vector<SegmentInfo>* covered) {
+  std::vector<SegmentInfo> segments;
+
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+    const auto& path = entry.path();
+    StorageFormat format;
+    if (path.extension() == kTextExtension) {
+      format = StorageFormat::Text;
+    } else if (path.extension() == kBlockExtension) {
+      format = StorageFormat::Block;
+    } else {
+      continue;
+    }
+
+    unsigned long long first;
+    unsigned long long last;
+    int fields = std::sscanf(path.stem().string().c_str(), "segment-%llu_%llu", &first, &last);
+    if (fields < 1) {
+      continue;
+    }
+    if (fields == 1) {
+      last = first;
+    }
+
+    segments.push_back({
+      last,
+      first,
+      format,
+      segmentDataPath(directory, first, last, format),
+      segmentIndexPath(directory, first, last)
+    });
+  }
+
+  // Widest range first among equal starts, so anything a compacted segment
+  // covers comes right after it
+  std::sort(segments.begin(), segments.end(), [](const SegmentInfo& a, const SegmentInfo& b) {
+    return a.firstSequence != b.firstSequence ? a.firstSequence < b.firstSequence : a.sequence > b.sequence;
+  });
+
+  std::vector<SegmentInfo> live;
+  for (auto& segment : segments) {
+    if (!live.empty() && segment.sequence <= live.back().sequence) {
+      if (covered) {
+        covered->push_back(std::move(segment));
+      }
+      continue;
+    }
+    live.push_back(std::move(segment));
+  }
+  return live;
+}
+
+bool syncDirectory(const std::string& directory) {
+  int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = ::fsync(fd) == 0;
+  ::close(fd);
+  return ok;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class StorageFormat {
+  Text,                                                     // `.log`: framed text lines, see record_format.h
+  Block                                                     // `.blk`: compressed column blocks, see block_format.h
+};
+
+// A compacted segment (`segment-<first>_<last>`) replaces segments `first`
+// through `last` and sorts as `last`
+struct SegmentInfo {
+  uint64_t sequence;
+  uint64_t firstSequence;                                   // Equal to `sequence` unless compacted
+  StorageFormat format;
+  std::string dataPath;
+  std::string indexPath;
+};
+
+std::string segmentDataPath(const std::string& directory, uint64_t sequence, StorageFormat format);
+std::string segmentIndexPath(const std::string& directory, uint64_t sequence);
+std::string segmentDataPath(const std::string& directory, uint64_t first, uint64_t last, StorageFormat format);
+std::string segmentIndexPath(const std::string& directory, uint64_t first, uint64_t last);
+
+// Where a compacted segment's records came from; see segment_maintenance.h
+std::string segmentMapPath(const std::string& directory, uint64_t first, uint64_t last);
+
+// Segments in `directory`, oldest first. Segments replaced by a compacted one
+// whose inputs were not deleted yet are left out, or put in `covered`.
+std::vector<SegmentInfo> listSegments(const std::string& directory, std::vector<SegmentInfo>* covered = nullptr);
+
+// fsync the directory so newly created segment files survive a crash
+bool syncDirectory(const std::string& directory);
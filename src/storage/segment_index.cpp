@@ -0,0 +1,225 @@
+#include "segment_index.h"
+#include "trigram_filter.h"
+#include "varint.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string_view>
+
+const char kSegmentIndexMagic[4] = {'L', 'G', 'I', '1'};
+
+namespace {
+
+void putBytes(std::string& out, std::string_view bytes) {
+  putVarint(out, bytes.size());
+  out.append(bytes.data(), bytes.size());
+}
+
+bool getBytes(std::string_view data, size_t& pos, std::string& bytes) {
+  uint64_t size;
+  if (!getVarint(data, pos, size) || size > data.size() - pos) {
+    return false;
+  }
+  bytes.assign(data.data() + pos, size);
+  pos += size;
+  return true;
+}
+
+bool decodeBlockEntry(std::string_view entry, BlockEntry& block) {
+  size_t pos = 0;
+  uint64_t count;
+  uint64_t span;
+  if (!getVarint(entry, pos, block.offset) ||
+      !getVarint(entry, pos, block.length) ||
+      !getVarint(entry, pos, count) ||
+      !getSignedVarint(entry, pos, block.minTimestamp) ||
+      !getVarint(entry, pos, span)) {
+    return false;
+  }
+  block.count = static_cast<uint32_t>(count);
+  block.maxTimestamp = block.minTimestamp + static_cast<int64_t>(span);
+
+  if (pos == entry.size()) {
+    return true;
+  }
+
+  uint64_t serviceCount;
+  // Each service is at least an empty name and an empty posting list
+  if (!getVarint(entry, pos, serviceCount) || serviceCount > (entry.size() - pos) / 2) {
+    return false;
+  }
+  block.services.resize(serviceCount);
+  for (auto& [service, postings] : block.services) {
+    if (!getBytes(entry, pos, service) || !getBytes(entry, pos, postings)) {
+      return false;
+    }
+  }
+  for (auto& postings : block.levels) {
+    if (!getBytes(entry, pos, postings)) {
+      return false;
+    }
+  }
+  block.hasPostings = true;
+
+  if (pos == entry.size()) {
+    return true;
+  }
+  block.hasTrigrams = getBytes(entry, pos, block.trigrams);
+  return block.hasTrigrams;
+}
+
+}
+
+const PostingList* BlockEntry::servicePostings(const std::string& service) const {
+  auto it = std::lower_bound(services.begin(), services.end(), service, [](const auto& entry, const std::string& name) {
+    return entry.first < name;
+  });
+  if (it == services.end() || it->first != service) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+bool BlockEntry::mayContain(const std::vector<uint32_t>& needleTrigrams) const {
+  return !hasTrigrams || needleTrigrams.empty() || filterMayContain(trigrams, needleTrigrams);
+}
+
+void PostingBuilder::append(List& list, uint32_t relativeOffset) {
+  putVarint(list.encoded, relativeOffset - list.last);
+  list.last = relativeOffset;
+}
+
+void PostingBuilder::add(const std::string& service, LogLevel level, uint32_t relativeOffset) {
+  auto it = std::find_if(services_.begin(), services_.end(), [&](const auto& entry) {
+    return entry.first == service;
+  });
+  if (it == services_.end()) {
+    services_.emplace_back(service, List{});
+    it = services_.end() - 1;
+  }
+  append(it->second, relativeOffset);
+  append(levels_[static_cast<size_t>(level)], relativeOffset);
+}
+
+void PostingBuilder::finish(BlockEntry& block) {
+  std::sort(services_.begin(), services_.end(), [](const auto& a, const auto& b) {
+    return a.first < b.first;
+  });
+
+  block.services.clear();
+  for (auto& [service, list] : services_) {
+    block.services.emplace_back(service, std::move(list.encoded));
+  }
+  for (size_t i = 0; i < kLogLevelCount; ++i) {
+    block.levels[i] = std::move(levels_[i].encoded);
+  }
+  block.hasPostings = true;
+
+  services_.clear();
+  levels_ = {};
+}
+
+std::vector<uint32_t> decodePostings(const PostingList& list) {
+  std::vector<uint32_t> offsets;
+  size_t pos = 0;
+  uint64_t delta;
+  uint32_t current = 0;
+  while (pos < list.size() && getVarint(list, pos, delta)) {
+    current += static_cast<uint32_t>(delta);
+    offsets.push_back(current);
+  }
+  return offsets;
+}
+
+std::vector<uint32_t> intersectPostings(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+  std::vector<uint32_t> result;
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+  return result;
+}
+
+void SegmentIndex::add(const BlockEntry& block) {
+  blocks.push_back(block);
+  minTimestamp = std::min(minTimestamp, block.minTimestamp);
+  maxTimestamp = std::max(maxTimestamp, block.maxTimestamp);
+}
+
+uint64_t SegmentIndex::indexedBytes() const {
+  return blocks.empty() ? 0 : blocks.back().offset + blocks.back().length;
+}
+
+void encodeBlockEntry(std::string& out, const BlockEntry& block) {
+  std::string payload;
+  putVarint(payload, block.offset);
+  putVarint(payload, block.length);
+  putVarint(payload, block.count);
+  putSignedVarint(payload, block.minTimestamp);
+  putVarint(payload, static_cast<uint64_t>(block.maxTimestamp - block.minTimestamp));
+
+  if (block.hasPostings) {
+    putVarint(payload, block.services.size());
+    for (const auto& [service, postings] : block.services) {
+      putBytes(payload, service);
+      putBytes(payload, postings);
+    }
+    for (const auto& postings : block.levels) {
+      putBytes(payload, postings);
+    }
+    if (block.hasTrigrams) {
+      putBytes(payload, block.trigrams);
+    }
+  }
+
+  putVarint(out, payload.size());
+  out += payload;
+}
+
+void SegmentIndex::refresh(const std::string& path) {
+  if (corrupt) {
+    return;
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return;
+  }
+
+  file.seekg(static_cast<std::streamoff>(sidecarBytes), std::ios::beg);
+  std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::string_view data(content);
+
+  size_t pos = 0;
+  if (sidecarBytes == 0) {
+    std::string_view magic(kSegmentIndexMagic, sizeof(kSegmentIndexMagic));
+    if (data.substr(0, magic.size()) != magic) {
+      return;
+    }
+    pos = magic.size();
+  }
+
+  while (pos < data.size()) {
+    size_t start = pos;
+    uint64_t entrySize;
+    if (!getVarint(data, pos, entrySize) || entrySize > data.size() - pos) {
+      pos = start;                                          // Torn tail, retry on the next refresh
+      break;
+    }
+
+    BlockEntry block;
+    if (!decodeBlockEntry(data.substr(pos, entrySize), block)) {
+      corrupt = true;                                       // Fully written, so retrying cannot help
+      pos = start;
+      break;
+    }
+    pos += entrySize;
+
+    add(block);
+  }
+
+  sidecarBytes += pos;
+}
+
+SegmentIndex SegmentIndex::load(const std::string& path) {
+  SegmentIndex index;
+  index.refresh(path);
+  return index;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "../logging/log_level.h"
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Delta/varint-encoded, ascending record offsets relative to a block's start
+using PostingList = std::string;
+
+// A contiguous run of records in a segment's data file. Blocks are cut every
+// `indexInterval` records, so they double as a sparse offset index.
+struct BlockEntry {
+  uint64_t offset = 0;
+  uint64_t length = 0;
+  uint32_t count = 0;
+  int64_t minTimestamp = std::numeric_limits<int64_t>::max();
+  int64_t maxTimestamp = std::numeric_limits<int64_t>::min();
+
+  // Inverted index over the block. Entries written before postings existed
+  // have `hasPostings == false` and must be scanned.
+  bool hasPostings = false;
+  std::vector<std::pair<std::string, PostingList>> services;
+  std::array<PostingList, kLogLevelCount> levels;
+
+  // Optional trigram Bloom filter over the block's messages
+  bool hasTrigrams = false;
+  std::string trigrams;
+
+  bool overlaps(int64_t from, int64_t to) const {
+    return minTimestamp <= to && maxTimestamp >= from;
+  }
+
+  const PostingList* servicePostings(const std::string& service) const;
+
+  // False only if no message in the block can contain text with these trigrams
+  bool mayContain(const std::vector<uint32_t>& needleTrigrams) const;
+};
+
+// Builds the posting lists for one block as its records are written
+class PostingBuilder {
+public:
+  void add(const std::string& service, LogLevel level, uint32_t relativeOffset);
+  void finish(BlockEntry& block);
+
+private:
+  struct List {
+    PostingList encoded;
+    uint32_t last = 0;
+  };
+
+  static void append(List& list, uint32_t relativeOffset);
+
+  std::vector<std::pair<std::string, List>> services_;
+  std::array<List, kLogLevelCount> levels_;
+};
+
+std::vector<uint32_t> decodePostings(const PostingList& list);
+
+// Both inputs ascending
+std::vector<uint32_t> intersectPostings(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+
+// In-memory form of a segment's `.idx` sidecar. The sidecar is append-only:
+// the writer appends one entry per block after the block's bytes are flushed,
+// so bytes past `indexedBytes()` may exist but are not yet described.
+struct SegmentIndex {
+  std::vector<BlockEntry> blocks;
+  int64_t minTimestamp = std::numeric_limits<int64_t>::max();
+  int64_t maxTimestamp = std::numeric_limits<int64_t>::min();
+  uint64_t sidecarBytes = 0;                                // Bytes of the sidecar decoded so far
+  bool corrupt = false;                                     // A complete entry failed to decode
+
+  void add(const BlockEntry& block);
+  uint64_t indexedBytes() const;
+
+  bool overlaps(int64_t from, int64_t to) const {
+    return minTimestamp <= to && maxTimestamp >= from;
+  }
+
+  // Decodes entries appended to the sidecar since the last call. Missing or
+  // torn sidecars yield whatever prefix could be decoded. A corrupt sidecar
+  // keeps the prefix before the bad entry and is not read again; readers scan
+  // the rest of the segment until the sidecar is rebuilt.
+  void refresh(const std::string& path);
+
+  static SegmentIndex load(const std::string& path);
+};
+
+extern const char kSegmentIndexMagic[4];
+
+void encodeBlockEntry(std::string& out, const BlockEntry& block);
@@ -0,0 +1,356 @@
+#include "segment_maintenance.h"
+#include "block_format.h"
+#include "mapped_file.h"
+#include "record_format.h"
+#include "segment_directory.h"
+#include "segment_index.h"
+#include "varint.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace {
+
+constexpr const char* kTemporarySuffix = ".tmp";
+constexpr char kMapMagic[4] = {'L', 'G', 'M', '1'};
+
+// One input of a compacted segment: the output ordinal of its first record
+// and, for each of its records, the input position just past it
+struct MapEntry {
+  uint64_t first;
+  uint64_t sequence;
+  uint64_t base;
+  std::vector<uint64_t> ends;
+};
+
+std::string mapPathOf(const SegmentInfo& segment) {
+  return segmentMapPath(std::filesystem::path(segment.dataPath).parent_path().string(), segment.firstSequence, segment.sequence);
+}
+
+void encodeMapEntry(std::string& out, const MapEntry& entry) {
+  putVarint(out, entry.first);
+  putVarint(out, entry.sequence);
+  putVarint(out, entry.base);
+  putVarint(out, entry.ends.size());
+  uint64_t previous = 0;
+  for (uint64_t end : entry.ends) {
+    putVarint(out, end - previous);
+    previous = end;
+  }
+}
+
+// False if the map is missing or torn
+bool readMap(const std::string& path, std::vector<MapEntry>& entries) {
+  auto file = MappedFile::open(path);
+  if (!file) {
+    return false;
+  }
+  std::string_view data = file->bytes();
+  if (data.substr(0, sizeof(kMapMagic)) != std::string_view(kMapMagic, sizeof(kMapMagic))) {
+    return false;
+  }
+
+  size_t pos = sizeof(kMapMagic);
+  while (pos < data.size()) {
+    MapEntry entry;
+    uint64_t count;
+    if (!getVarint(data, pos, entry.first) || !getVarint(data, pos, entry.sequence) || !getVarint(data, pos, entry.base) ||
+        !getVarint(data, pos, count) || count > data.size() - pos) {
+      return false;
+    }
+    entry.ends.reserve(count);
+    uint64_t end = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+      uint64_t delta;
+      if (!getVarint(data, pos, delta)) {
+        return false;
+      }
+      end += delta;
+      entry.ends.push_back(end);
+    }
+    entries.push_back(std::move(entry));
+  }
+  return true;
+}
+
+// Records of the segment a map describes
+uint64_t mapRecords(const std::vector<MapEntry>& entries) {
+  uint64_t records = 0;
+  for (const auto& entry : entries) {
+    records = std::max<uint64_t>(records, entry.base + entry.ends.size());
+  }
+  return records;
+}
+
+uint64_t fileSize(const std::string& path) {
+  std::error_code ec;
+  uint64_t size = std::filesystem::file_size(path, ec);
+  return ec ? 0 : size;
+}
+
+// The data file goes first: readers that find it missing list again
+void removeSegment(const SegmentInfo& segment) {
+  std::error_code ec;
+  std::filesystem::remove(segment.dataPath, ec);
+  std::filesystem::remove(segment.indexPath, ec);
+  if (segment.firstSequence != segment.sequence) {
+    std::filesystem::remove(mapPathOf(segment), ec);
+  }
+}
+
+// Calls `visit(record, next)`, where `next` is the position a query cursor
+// resumes at after the record, as the file scans report it
+template <typename Visit>
+void forEachRecord(StorageFormat format, std::string_view bytes, Visit&& visit) {
+  if (format == StorageFormat::Text) {
+    std::string unescaped;
+    size_t pos = 0;
+    while (pos < bytes.size()) {
+      size_t newline = bytes.find('\n', pos);
+      if (newline == std::string_view::npos) {
+        break;
+      }
+      RecordFields fields;
+      if (parseRecord(bytes.substr(pos, newline - pos), fields)) {
+        if (fields.escaped) {
+          unescapeMessage(fields.message, unescaped);
+          fields.message = unescaped;
+        }
+        visit(LogRecordView{fields.timestamp, fields.service, fields.level, fields.message}, newline + 1);
+      }
+      pos = newline + 1;
+    }
+    return;
+  }
+
+  BlockDecoder block;
+  for (size_t pos = 0; pos < bytes.size() && block.open(bytes.substr(pos)); pos += block.size()) {
+    if (!block.decodeColumns() || !block.decodeMessages()) {
+      continue;
+    }
+    for (size_t i = 0; i < block.count(); ++i) {
+      visit(LogRecordView{block.timestamp(i), block.service(block.serviceId(i)), block.level(i), block.message(i)}, i + 1 < block.count() ? pos + i + 1 : pos + block.size());
+    }
+  }
+}
+
+// Temporary files of a pass that was interrupted, and inputs of a finished
+// compaction that were not deleted yet
+void removeLeftovers(const std::string& directory, const std::vector<SegmentInfo>& covered) {
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+    const auto& path = entry.path();
+    if (path.extension() == kTemporarySuffix && path.filename().string().rfind("segment-", 0) == 0) {
+      std::error_code removeError;
+      std::filesystem::remove(path, removeError);
+    }
+  }
+  for (const auto& segment : covered) {
+    removeSegment(segment);
+  }
+}
+
+bool compactRun(const std::string& directory, const std::vector<SegmentInfo>& run, const MaintenanceOptions& options) {
+  uint64_t first = run.front().firstSequence;
+  uint64_t last = run.back().sequence;
+  std::string dataPath = segmentDataPath(directory, first, last, StorageFormat::Block);
+  std::string indexPath = segmentIndexPath(directory, first, last);
+  std::string mapPath = segmentMapPath(directory, first, last);
+
+  SegmentOptions output = options.output;
+  output.format = StorageFormat::Block;
+  size_t interval = std::max<uint32_t>(output.indexInterval, 1);
+
+  std::error_code ec;
+  auto written = std::filesystem::last_write_time(run.back().dataPath, ec);
+  bool ok = !ec;
+  std::string map(kMapMagic, sizeof(kMapMagic));
+  {
+    SegmentWriter writer(dataPath + kTemporarySuffix, indexPath + kTemporarySuffix, last, output);
+
+    // Appended a block at a time so the output has full-sized blocks
+    std::vector<LogRecord> batch;
+    batch.reserve(interval);
+    uint64_t records = 0;
+    for (const auto& segment : run) {
+      auto data = MappedFile::open(segment.dataPath);
+      if (!data) {
+        ok = false;
+        break;
+      }
+      MapEntry entry{segment.firstSequence, segment.sequence, records, {}};
+      forEachRecord(segment.format, data->bytes(), [&](const LogRecordView& log, uint64_t next) {
+        entry.ends.push_back(next);
+        batch.push_back(toRecord(log));
+        if (batch.size() == interval) {
+          ok = writer.append(batch.data(), batch.size()) && ok;
+          batch.clear();
+        }
+      });
+
+      // A compacted input's own map still places cursors into what it replaced
+      std::vector<MapEntry> inputs;
+      if (segment.firstSequence != segment.sequence && readMap(mapPathOf(segment), inputs) && mapRecords(inputs) == entry.ends.size()) {
+        for (auto& input : inputs) {
+          input.base += records;
+          encodeMapEntry(map, input);
+        }
+      }
+      encodeMapEntry(map, entry);
+      records += entry.ends.size();
+    }
+    if (ok && !batch.empty()) {
+      ok = writer.append(batch.data(), batch.size());
+    }
+    ok = ok && writer.syncAll();
+  }
+
+  // The map only serves cursors into the inputs, so failing to write it
+  // leaves those to restart but doesn't stop the compaction
+  if (ok) {
+    std::ofstream file(mapPath + kTemporarySuffix, std::ios::binary | std::ios::trunc);
+    file.write(map.data(), static_cast<std::streamsize>(map.size()));
+    file.close();
+    std::error_code mapError;
+    if (file) {
+      std::filesystem::rename(mapPath + kTemporarySuffix, mapPath, mapError);
+    } else {
+      std::filesystem::remove(mapPath + kTemporarySuffix, mapError);
+    }
+  }
+
+  // The sidecar is renamed first, so a listed data file always has its own
+  if (ok) {
+    std::filesystem::last_write_time(dataPath + kTemporarySuffix, written, ec);
+  }
+  if (ok && !ec) {
+    std::filesystem::rename(indexPath + kTemporarySuffix, indexPath, ec);
+  }
+  if (ok && !ec) {
+    std::filesystem::rename(dataPath + kTemporarySuffix, dataPath, ec);
+  }
+  if (!ok || ec) {
+    std::filesystem::remove(dataPath + kTemporarySuffix, ec);
+    std::filesystem::remove(indexPath + kTemporarySuffix, ec);
+    std::filesystem::remove(mapPath, ec);
+    return false;
+  }
+  syncDirectory(directory);
+
+  for (const auto& segment : run) {
+    removeSegment(segment);
+  }
+  return true;
+}
+
+}
+
+MaintenanceResult maintainSegments(const std::string& directory, uint64_t active, const MaintenanceOptions& options, const ExpiredVisitor& expired) {
+  MaintenanceResult result;
+
+  std::vector<SegmentInfo> covered;
+  auto segments = listSegments(directory, &covered);
+  removeLeftovers(directory, covered);
+
+  // Retention, oldest first
+  uint64_t total = 0;
+  for (const auto& segment : segments) {
+    total += fileSize(segment.dataPath) + fileSize(segment.indexPath);
+  }
+  auto now = std::filesystem::file_time_type::clock::now();
+
+  size_t kept = 0;
+  for (; kept < segments.size() && segments[kept].sequence < active; ++kept) {
+    const auto& segment = segments[kept];
+    std::error_code ec;
+    auto written = std::filesystem::last_write_time(segment.dataPath, ec);
+    bool old = options.retentionAge.count() > 0 && !ec && now - written > options.retentionAge;
+    bool over = options.retentionBytes > 0 && total > options.retentionBytes;
+    if (!old && !over) {
+      break;
+    }
+
+    if (expired) {
+      if (auto data = MappedFile::open(segment.dataPath)) {
+        forEachRecord(segment.format, data->bytes(), [&](const LogRecordView& log, uint64_t) {
+          expired(log);
+        });
+      }
+    }
+    total -= std::min(total, fileSize(segment.dataPath) + fileSize(segment.indexPath));
+    removeSegment(segment);
+    ++result.expired;
+  }
+
+  if (!options.compaction) {
+    return result;
+  }
+
+  // Runs of consecutive closed segments that are text or small are merged, up
+  // to the target size but always at least two at a time. A lone text
+  // segment waits for a neighbour, since a single-segment output would share
+  // its sidecar name.
+  std::vector<SegmentInfo> run;
+  uint64_t runBytes = 0;
+  auto flush = [&] {
+    if (run.size() >= 2 && compactRun(directory, run, options)) {
+      result.compacted += run.size();
+    }
+    run.clear();
+    runBytes = 0;
+  };
+
+  for (size_t i = kept; i < segments.size() && segments[i].sequence < active; ++i) {
+    const auto& segment = segments[i];
+    uint64_t size = fileSize(segment.dataPath);
+    if (segment.format == StorageFormat::Block && size >= options.compactTargetBytes / 2) {
+      flush();
+      continue;
+    }
+    if (run.size() >= 2 && runBytes + size > options.compactTargetBytes) {
+      flush();
+    }
+    run.push_back(segment);
+    runBytes += size;
+  }
+  flush();
+
+  return result;
+}
+
+std::optional<uint64_t> compactedOffset(const SegmentInfo& compacted, uint64_t first, uint64_t sequence, uint64_t offset) {
+  std::vector<MapEntry> entries;
+  if (!readMap(mapPathOf(compacted), entries)) {
+    return std::nullopt;
+  }
+  auto entry = std::find_if(entries.begin(), entries.end(), [&](const MapEntry& input) {
+    return input.first == first && input.sequence == sequence;
+  });
+  if (entry == entries.end()) {
+    return std::nullopt;
+  }
+  uint64_t ordinal = entry->base + static_cast<uint64_t>(std::upper_bound(entry->ends.begin(), entry->ends.end(), offset) - entry->ends.begin());
+
+  // Output records are in column blocks, where record i of a block at
+  // offset o is resumed at with o + i
+  SegmentIndex index = SegmentIndex::load(compacted.indexPath);
+  uint64_t records = 0;
+  for (const auto& block : index.blocks) {
+    records += block.count;
+  }
+  if (records != mapRecords(entries)) {
+    return std::nullopt;
+  }
+  uint64_t before = 0;
+  for (const auto& block : index.blocks) {
+    if (ordinal < before + block.count) {
+      return block.offset + (ordinal - before);
+    }
+    before += block.count;
+  }
+  return index.indexedBytes();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../logging/log_record.h"
+#include "segment_writer.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+
+struct MaintenanceOptions {
+  std::chrono::seconds retentionAge{0};                     // Delete segments not written to for this long; 0 keeps them
+  uint64_t retentionBytes = 0;                              // Delete the oldest segments past this total size; 0 keeps them
+  bool compaction = false;                                  // Merge small and text segments into block segments
+  uint64_t compactTargetBytes = 64 * 1024 * 1024;           // Input bytes merged into one segment at most
+  SegmentOptions output;                                    // Compacted segments are always written as blocks
+};
+
+// Told every record of a segment about to be deleted
+using ExpiredVisitor = std::function<void(const LogRecordView&)>;
+
+struct MaintenanceResult {
+  size_t expired = 0;                                       // Segments deleted by retention
+  size_t compacted = 0;                                     // Segments merged into others
+};
+
+// One maintenance pass over `directory`: removes what an interrupted pass
+// left behind, applies retention, then compacts. Segments from `active` on
+// are still being written and never touched.
+//
+// A compacted segment is written under a temporary name, synced and renamed
+// into place before its inputs are deleted, and listSegments() hides inputs
+// it covers, so a crash at any point leaves each record listed exactly once.
+// Readers that mapped a file before it was deleted keep their mapping. The
+// output keeps the newest input's mtime, which retention goes by. Next to it
+// a `.map` file records where each input's records went, see
+// compactedOffset().
+MaintenanceResult maintainSegments(const std::string& directory, uint64_t active, const MaintenanceOptions& options, const ExpiredVisitor& expired = nullptr);
+
+// Where a query cursor at `offset` into segment `first`..`sequence` resumes in
+// `compacted`, which replaced that segment, possibly through earlier
+// compactions. nullopt if the map is missing or doesn't cover it.
+std::optional<uint64_t> compactedOffset(const SegmentInfo& compacted, uint64_t first, uint64_t sequence, uint64_t offset);
@@ -0,0 +1,140 @@
+#include "segment_recovery.h"
+#include "block_format.h"
+#include "mapped_file.h"
+#include "record_format.h"
+#include "segment_index.h"
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+namespace {
+
+bool writeFile(const std::string& path, const std::string& content) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = ::write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()) && ::fdatasync(fd) == 0;
+  ::close(fd);
+  return ok;
+}
+
+bool replaceIndex(const SegmentInfo& segment, const std::string& sidecar) {
+  std::string temporary = segment.indexPath + ".tmp";
+  return writeFile(temporary, sidecar) && std::rename(temporary.c_str(), segment.indexPath.c_str()) == 0;
+}
+
+}
+
+uint64_t recoverSegment(const SegmentInfo& segment) {
+  auto data = MappedFile::open(segment.dataPath);
+  if (!data) {
+    return 0;
+  }
+
+  std::string_view bytes = data->bytes();
+  uint64_t validEnd = 0;
+
+  if (segment.format == StorageFormat::Block) {
+    // Blocks are only delimited by their headers, so nothing after the first
+    // bad one can be trusted
+    BlockDecoder block;
+    while (validEnd < bytes.size() && block.open(bytes.substr(validEnd)) && block.verify()) {
+      validEnd += block.size();
+    }
+  } else {
+    // Corrupt lines in the middle are left for readers to skip; only the tail
+    // after the last good record can be a torn write
+    size_t pos = 0;
+    while (pos < bytes.size()) {
+      size_t newline = bytes.find('\n', pos);
+      if (newline == std::string_view::npos) {
+        break;
+      }
+      if (verifyRecord(bytes.substr(pos, newline - pos))) {
+        validEnd = newline + 1;
+      }
+      pos = newline + 1;
+    }
+  }
+
+  uint64_t removed = bytes.size() - validEnd;
+  data.reset();
+
+  if (removed > 0 && ::truncate(segment.dataPath.c_str(), static_cast<off_t>(validEnd)) != 0) {
+    return 0;
+  }
+
+  SegmentIndex index = SegmentIndex::load(segment.indexPath);
+  if (index.indexedBytes() > validEnd) {
+    std::string sidecar(kSegmentIndexMagic, sizeof(kSegmentIndexMagic));
+    for (const auto& block : index.blocks) {
+      if (block.offset + block.length <= validEnd) {
+        encodeBlockEntry(sidecar, block);
+      }
+    }
+    replaceIndex(segment, sidecar);
+  }
+
+  return removed;
+}
+
+bool repairIndex(const SegmentInfo& segment, uint32_t indexInterval) {
+  if (!SegmentIndex::load(segment.indexPath).corrupt) {
+    return false;
+  }
+  auto data = MappedFile::open(segment.dataPath);
+  if (!data) {
+    return false;
+  }
+
+  std::string_view bytes = data->bytes();
+  std::string sidecar(kSegmentIndexMagic, sizeof(kSegmentIndexMagic));
+
+  if (segment.format == StorageFormat::Block) {
+    BlockDecoder decoder;
+    for (uint64_t offset = 0; offset < bytes.size() && decoder.open(bytes.substr(offset)); offset += decoder.size()) {
+      BlockEntry block;
+      block.offset = offset;
+      block.length = decoder.size();
+      block.count = decoder.count();
+      block.minTimestamp = decoder.minTimestamp();
+      block.maxTimestamp = decoder.maxTimestamp();
+      encodeBlockEntry(sidecar, block);
+    }
+  } else {
+    // Malformed lines stay inside whichever block they fall in
+    BlockEntry block;
+    RecordFields fields;
+    size_t pos = 0;
+    while (pos < bytes.size()) {
+      size_t newline = bytes.find('\n', pos);
+      if (newline == std::string_view::npos) {
+        break;
+      }
+      if (parseRecord(bytes.substr(pos, newline - pos), fields)) {
+        ++block.count;
+        block.minTimestamp = std::min(block.minTimestamp, fields.timestamp);
+        block.maxTimestamp = std::max(block.maxTimestamp, fields.timestamp);
+      }
+      pos = newline + 1;
+
+      if (block.count == std::max<uint32_t>(indexInterval, 1)) {
+        block.length = pos - block.offset;
+        encodeBlockEntry(sidecar, block);
+        block = BlockEntry{};
+        block.offset = pos;
+      }
+    }
+    if (block.count > 0) {
+      block.length = pos - block.offset;
+      encodeBlockEntry(sidecar, block);
+    }
+  }
+
+  data.reset();
+  return replaceIndex(segment, sidecar);
+}
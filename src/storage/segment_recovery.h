@@ -0,0 +1,14 @@
+#pragma once
+
+#include "segment_directory.h"
+#include <cstdint>
+
+// Truncates a torn tail left by a crash: drops bytes after the last record
+// whose frame verifies, and sidecar entries describing bytes that are gone.
+// Returns the number of data bytes removed.
+uint64_t recoverSegment(const SegmentInfo& segment);
+
+// Rewrites a sidecar holding an entry that fails to decode from the segment's
+// data. The rebuilt entries have no postings or trigrams, so their blocks are
+// scanned rather than looked up. Returns true if the sidecar was rewritten.
+bool repairIndex(const SegmentInfo& segment, uint32_t indexInterval);
@@ -0,0 +1,129 @@
+#include "segment_writer.h"
+#include "block_format.h"
+#include "record_format.h"
+#include "segment_directory.h"
+#include "trigram_filter.h"
+#include "../../include/errors/http_error.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+bool writeAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = ::write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+int openForAppend(const std::string& path) {
+  return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+}
+
+}
+
+SegmentWriter::SegmentWriter(const std::string& directory, uint64_t sequence, const SegmentOptions& options)
+  : SegmentWriter(segmentDataPath(directory, sequence, options.format), segmentIndexPath(directory, sequence), sequence, options) {}
+
+SegmentWriter::SegmentWriter(const std::string& dataPath, const std::string& indexPath, uint64_t sequence, const SegmentOptions& options)
+  : sequence_(sequence),
+    options_(options),
+    bytes_(0),
+    openedAt_(std::chrono::steady_clock::now()),
+    data_(openForAppend(dataPath)),
+    index_(openForAppend(indexPath)) {
+  if (data_ < 0 || index_ < 0 || !writeAll(index_, kSegmentIndexMagic, sizeof(kSegmentIndexMagic))) {
+    if (data_ >= 0) ::close(data_);
+    if (index_ >= 0) ::close(index_);
+    throw HttpError(500, "Failed to open log segment");
+  }
+  options_.indexInterval = std::max<uint32_t>(options_.indexInterval, 1);
+}
+
+SegmentWriter::~SegmentWriter() {
+  ::close(data_);
+  ::close(index_);
+}
+
+uint64_t SegmentWriter::sequence() const {
+  return sequence_;
+}
+
+uint64_t SegmentWriter::bytes() const {
+  return bytes_;
+}
+
+std::chrono::steady_clock::time_point SegmentWriter::openedAt() const {
+  return openedAt_;
+}
+
+bool SegmentWriter::append(const LogRecord* records, size_t count) {
+  std::string data;
+  std::string entries;
+
+  for (size_t start = 0; start < count; start += options_.indexInterval) {
+    size_t end = std::min<size_t>(count, start + options_.indexInterval);
+
+    BlockEntry block;
+    block.offset = bytes_ + data.size();
+    PostingBuilder postings;
+    TrigramFilterBuilder trigrams;
+
+    // Postings hold byte offsets into text blocks and record ordinals in column blocks
+    for (size_t i = start; i < end; ++i) {
+      const auto& log = records[i];
+      if (options_.format == StorageFormat::Block) {
+        postings.add(log.service, log.level, static_cast<uint32_t>(i - start));
+      } else {
+        postings.add(log.service, log.level, static_cast<uint32_t>(bytes_ + data.size() - block.offset));
+        formatRecord(data, log);
+      }
+
+      if (options_.trigramIndex) {
+        trigrams.add(log.message);
+      }
+
+      block.minTimestamp = std::min(block.minTimestamp, log.timestamp);
+      block.maxTimestamp = std::max(block.maxTimestamp, log.timestamp);
+    }
+
+    if (options_.format == StorageFormat::Block) {
+      encodeBlock(data, records + start, end - start);
+    }
+
+    block.count = static_cast<uint32_t>(end - start);
+    block.length = bytes_ + data.size() - block.offset;
+    postings.finish(block);
+    if (options_.trigramIndex) {
+      block.hasTrigrams = true;
+      block.trigrams = trigrams.finish();
+    }
+    encodeBlockEntry(entries, block);
+  }
+
+  // Data must be written before the index entries that describe it
+  if (!writeAll(data_, data.data(), data.size())) {
+    return false;
+  }
+  bytes_ += data.size();
+
+  return writeAll(index_, entries.data(), entries.size());
+}
+
+bool SegmentWriter::sync() {
+  return ::fdatasync(data_) == 0;
+}
+
+bool SegmentWriter::syncAll() {
+  return ::fsync(data_) == 0 && ::fsync(index_) == 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../logging/log_record.h"
+#include "segment_directory.h"
+#include "segment_index.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct SegmentOptions {
+  uint32_t indexInterval = 1024;                            // Records per indexed block
+  StorageFormat format = StorageFormat::Text;
+  bool trigramIndex = false;                                // Store a message trigram filter per block
+};
+
+// Appends records to one segment and keeps its `.idx` sidecar in step.
+// Each writer is only used from one thread.
+class SegmentWriter {
+public:
+  SegmentWriter(const std::string& directory, uint64_t sequence, const SegmentOptions& options);
+  // Writes to the given paths, e.g. temporary ones renamed into place later
+  SegmentWriter(const std::string& dataPath, const std::string& indexPath, uint64_t sequence, const SegmentOptions& options);
+  ~SegmentWriter();
+
+  SegmentWriter(const SegmentWriter&) = delete;
+  SegmentWriter& operator=(const SegmentWriter&) = delete;
+
+  uint64_t sequence() const;
+  uint64_t bytes() const;
+  std::chrono::steady_clock::time_point openedAt() const;
+
+  // Both return false on an I/O error
+  bool append(const LogRecord* records, size_t count);
+  bool sync();                                              // fdatasync the data file; the sidecar is rebuilt by recovery
+  bool syncAll();                                           // fsync both files, for segments renamed into place
+
+private:
+  uint64_t sequence_;
+  SegmentOptions options_;
+  uint64_t bytes_;
+  std::chrono::steady_clock::time_point openedAt_;
+  int data_;
+  int index_;
+};
@@ -0,0 +1,107 @@
+#include "trigram_filter.h"
+#include <algorithm>
+
+namespace {
+
+constexpr size_t kMinBits = 64;
+constexpr size_t kMaxBits = 1 << 16;
+constexpr size_t kBitsPerTrigram = 10;
+
+// Filters end in this byte, after their power-of-two bit array. Filters
+// written before it existed have no trailing byte and use legacyProbes().
+constexpr char kMixedProbes = 1;
+
+uint32_t trigramAt(std::string_view text, size_t i) {
+  return static_cast<uint32_t>(static_cast<uint8_t>(text[i])) << 16 |
+         static_cast<uint32_t>(static_cast<uint8_t>(text[i + 1])) << 8 |
+         static_cast<uint32_t>(static_cast<uint8_t>(text[i + 2]));
+}
+
+// Two probe positions per trigram, from the two halves of a splitmix64 hash
+void probes(uint32_t trigram, size_t bits, size_t& first, size_t& second) {
+  uint64_t hash = trigram + 0x9E3779B97F4A7C15ull;
+  hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+  hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+  hash ^= hash >> 31;
+  first = static_cast<size_t>(hash) & (bits - 1);
+  second = static_cast<size_t>(hash >> 32) & (bits - 1);
+}
+
+// The low bits of a multiplicative hash are poorly mixed, so `second`
+// collides often; kept only to read older filters
+void legacyProbes(uint32_t trigram, size_t bits, size_t& first, size_t& second) {
+  uint64_t hash = static_cast<uint64_t>(trigram) * 0x9E3779B97F4A7C15ull;
+  first = static_cast<size_t>(hash >> 32) & (bits - 1);
+  second = static_cast<size_t>(hash) & (bits - 1);
+}
+
+bool testBit(std::string_view filter, size_t bit) {
+  return static_cast<uint8_t>(filter[bit / 8]) & (1u << (bit % 8));
+}
+
+}
+
+void TrigramFilterBuilder::add(std::string_view text) {
+  for (size_t i = 0; i + 3 <= text.size(); ++i) {
+    trigrams_.insert(trigramAt(text, i));
+  }
+}
+
+std::string TrigramFilterBuilder::finish() {
+  if (trigrams_.empty()) {
+    return {};
+  }
+
+  size_t bits = kMinBits;
+  while (bits < trigrams_.size() * kBitsPerTrigram && bits < kMaxBits) {
+    bits <<= 1;
+  }
+
+  std::string filter(bits / 8, '\0');
+  filter.push_back(kMixedProbes);
+  for (uint32_t trigram : trigrams_) {
+    size_t first;
+    size_t second;
+    probes(trigram, bits, first, second);
+    filter[first / 8] |= static_cast<char>(1u << (first % 8));
+    filter[second / 8] |= static_cast<char>(1u << (second % 8));
+  }
+
+  trigrams_.clear();
+  return filter;
+}
+
+std::vector<uint32_t> trigramsOf(std::string_view text) {
+  std::vector<uint32_t> trigrams;
+  for (size_t i = 0; i + 3 <= text.size(); ++i) {
+    trigrams.push_back(trigramAt(text, i));
+  }
+  std::sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+  return trigrams;
+}
+
+bool filterMayContain(std::string_view filter, const std::vector<uint32_t>& trigrams) {
+  bool mixed = filter.size() % 2 == 1 && filter.back() == kMixedProbes;
+  if (mixed) {
+    filter.remove_suffix(1);
+  }
+  size_t bits = filter.size() * 8;
+  if (bits == 0) {
+    return false;                                           // Block had no trigrams at all
+  }
+
+  for (uint32_t trigram : trigrams) {
+    size_t first;
+    size_t second;
+    if (mixed) {
+      probes(trigram, bits, first, second);
+    } else {
+      legacyProbes(trigram, bits, first, second);
+    }
+    if (!testBit(filter, first) || !testBit(filter, second)) {
+      return false;
+    }
+  }
+  return true;
+}
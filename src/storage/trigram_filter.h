@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Bloom filter over the byte trigrams of a block's messages. A substring
+// query can only match a block whose filter has every trigram of the needle.
+
+class TrigramFilterBuilder {
+public:
+  void add(std::string_view text);
+
+  // Encoded filter, sized at ~10 bits per distinct trigram; empty if no
+  // message had three bytes
+  std::string finish();
+
+private:
+  std::unordered_set<uint32_t> trigrams_;
+};
+
+// Distinct trigrams of `text`; empty if it is shorter than three bytes
+std::vector<uint32_t> trigramsOf(std::string_view text);
+
+bool filterMayContain(std::string_view filter, const std::vector<uint32_t>& trigrams);